@@ -41,8 +41,7 @@ helloworld_handler(bhttp_request *req, bhttp_response *res)
                        bstr_cstring(&req->uri),
                        bstr_cstring(&req->uri_path),
                        bstr_cstring(&req->uri_query));
-    bhttp_res_set_body_text(res, bstr_cstring(&bs));
-    bstr_free_contents(&bs);
+    bhttp_res_set_body_move(res, &bs);
     res->response_code = BHTTP_200_OK;
     return 0;
 }
@@ -68,8 +67,7 @@ helloworld_regex_handler(bhttp_request *req, bhttp_response *res, bvec *args)
     }
     bstr_append_cstring_nolen(&bs, "</html>");
 
-    bhttp_res_set_body_text(res, bstr_cstring(&bs));
-    bstr_free_contents(&bs);
+    bhttp_res_set_body_move(res, &bs);
     bhttp_res_add_header(res, "content-type", "text/html");
     res->response_code = BHTTP_200_OK;
     return 0;
@@ -131,19 +129,19 @@ hello_cookie_handler(bhttp_request *req, bhttp_response *res)
     bhttp_res_add_header(res, "content-t?ype", "text/html");
     bhttp_res_add_cookie(res, "cookietest1", "this is the value");
 
-    bhttp_cookie * cookie = bhttp_req_get_cookie(req);
-    if (cookie != NULL)
-        bhttp_cookie_print(cookie);
+    const bhttp_req_cookie *cookie = bhttp_req_cookie_get(req, "cookietest1");
 
     bstr bs;
     bstr_init(&bs);
-    bstr_append_printf(&bs, "<html><p>Hello, world! from URL: %s</p><p>%s</p><p>%s</p></html>",
+    bstr_append_printf(&bs, "<html><p>Hello, world! from URL: %s</p><p>%s</p><p>%s</p>",
                        bstr_cstring(&req->uri),
                        bstr_cstring(&req->uri_path),
                        bstr_cstring(&req->uri_query));
+    if (cookie != NULL)
+        bstr_append_printf(&bs, "<p>cookietest1: %.*s</p>", (int)cookie->value_len, cookie->value);
+    bstr_append_cstring_nolen(&bs, "</html>");
 
-    bhttp_res_set_body_text(res, bstr_cstring(&bs));
-    bstr_free_contents(&bs);
+    bhttp_res_set_body_move(res, &bs);
     res->response_code = BHTTP_200_OK;
     return 0;
 }
@@ -0,0 +1,210 @@
+/*
+ *  parser_bench.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+/*
+ * Times http_parser against fastparse on a file of recorded requests,
+ * `make bench` runs it on examples/requests.corpus. Both sides do the
+ * same work: find the method, uri and every header name and value.
+ *
+ *   ./parser_bench [corpus] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/http_parser.h"
+#include "../src/fastparse.h"
+
+#define MAX_REQUESTS    1024
+#define MAX_HEADERS     64
+
+typedef struct {
+    const char *data;
+    size_t len;
+} slice;
+
+/* what a parse produces, so neither side can skip work */
+typedef struct {
+    slice uri;
+    slice fields[MAX_HEADERS];
+    slice values[MAX_HEADERS];
+    int count;
+    int done;
+} result;
+
+static int
+on_begin(http_parser *p)
+{
+    result *r = p->data;
+    r->count = 0;
+    r->done = 0;
+    return 0;
+}
+
+static int
+on_url(http_parser *p, const char *at, size_t len)
+{
+    result *r = p->data;
+    r->uri.data = at;
+    r->uri.len = len;
+    return 0;
+}
+
+static int
+on_field(http_parser *p, const char *at, size_t len)
+{
+    result *r = p->data;
+    if (r->count < MAX_HEADERS)
+    {
+        r->fields[r->count].data = at;
+        r->fields[r->count].len = len;
+    }
+    return 0;
+}
+
+static int
+on_value(http_parser *p, const char *at, size_t len)
+{
+    result *r = p->data;
+    if (r->count < MAX_HEADERS)
+    {
+        r->values[r->count].data = at;
+        r->values[r->count].len = len;
+        r->count++;
+    }
+    return 0;
+}
+
+static int
+on_complete(http_parser *p)
+{
+    result *r = p->data;
+    r->done = 1;
+    http_parser_pause(p, 1);
+    return 0;
+}
+
+static http_parser_settings settings;
+
+static size_t
+split(const char *buf, size_t len, slice *reqs, size_t max)
+/* uses http_parser to cut the corpus into single requests */
+{
+    size_t n = 0;
+    result r;
+    while (len > 0 && n < max)
+    {
+        http_parser p;
+        http_parser_init(&p, HTTP_REQUEST);
+        p.data = &r;
+        size_t used = http_parser_execute(&p, &settings, buf, len);
+        if (!r.done)
+        {
+            fprintf(stderr, "corpus: %s after %zu requests\n",
+                    http_errno_description(HTTP_PARSER_ERRNO(&p)), n);
+            break;
+        }
+        reqs[n].data = buf;
+        reqs[n].len = used;
+        n++;
+        buf += used;
+        len -= used;
+    }
+    return n;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "examples/requests.corpus";
+    long rounds = argc > 2 ? atol(argv[2]) : 200000;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    static char corpus[1 << 20];
+    size_t len = fread(corpus, 1, sizeof corpus, f);
+    fclose(f);
+
+    http_parser_settings_init(&settings);
+    settings.on_message_begin = on_begin;
+    settings.on_url = on_url;
+    settings.on_header_field = on_field;
+    settings.on_header_value = on_value;
+    settings.on_message_complete = on_complete;
+
+    static slice reqs[MAX_REQUESTS];
+    size_t n = split(corpus, len, reqs, MAX_REQUESTS);
+    if (n == 0)
+        return 1;
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++)
+        bytes += reqs[i].len;
+
+    /* http_parser */
+    result r;
+    size_t check = 0;
+    double start = now();
+    for (long k = 0; k < rounds; k++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            http_parser p;
+            http_parser_init(&p, HTTP_REQUEST);
+            p.data = &r;
+            http_parser_execute(&p, &settings, reqs[i].data, reqs[i].len);
+            check += (size_t)r.count + r.uri.len;
+        }
+    }
+    double t_joyent = now() - start;
+
+    /* fastparse */
+    bhttp_fast_header headers[MAX_HEADERS];
+    bhttp_fast_head head;
+    size_t check_fast = 0;
+    start = now();
+    for (long k = 0; k < rounds; k++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            head.headers = headers;
+            head.num_headers = MAX_HEADERS;
+            if (bhttp_fast_parse_head(reqs[i].data, reqs[i].len, &head) < 0)
+            {
+                fprintf(stderr, "fastparse rejected request %zu\n", i);
+                return 1;
+            }
+            check_fast += head.num_headers + head.uri_len;
+        }
+    }
+    double t_fast = now() - start;
+
+    if (check != check_fast)
+        fprintf(stderr, "parsers disagree on the corpus\n");
+
+    double total = (double)rounds * (double)n;
+    printf("%zu requests, %zu bytes, %ld rounds\n", n, bytes, rounds);
+    printf("http_parser       %8.1f ns/req %8.1f MB/s\n",
+           t_joyent / total * 1e9, (double)bytes * (double)rounds / t_joyent / 1e6);
+    printf("fastparse %-7s %8.1f ns/req %8.1f MB/s\n", bhttp_fast_parse_engine(),
+           t_fast / total * 1e9, (double)bytes * (double)rounds / t_fast / 1e6);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ *  response_bench.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+/*
+ * Times bhttp_server_respond for a few typical responses, `make bench`
+ * runs it after parser_bench. Each request is parsed once, then answered
+ * over and over into a collecting bhttp_out that is never sent, with the
+ * connection arena reset in between as a keep-alive connection does. What
+ * is timed is the handler, the header block and queueing the body.
+ *
+ * Built with `make ZLIB=1` the server compresses at the given level, and
+ * the gzip cases time it on a JSON payload.
+ *
+ *   ./response_bench [rounds] [level]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/server.h"
+#include "../src/request.h"
+#include "../src/respond.h"
+#include "../src/output.h"
+#include "../src/arena.h"
+#include "../src/compress.h"
+
+static int
+text_handler(bhttp_request *req, bhttp_response *res)
+{
+    bhttp_res_set_body_text(res, "hello, world\n");
+    return 0;
+}
+
+static int
+json_handler(bhttp_request *req, bhttp_response *res)
+{
+    bhttp_res_add_header(res, "content-type", "application/json");
+    bhttp_res_add_header(res, "cache-control", "no-store");
+    bhttp_res_add_cookie(res, "session", "8f14e45fceea167a5a36dedd4bea2543");
+    bhttp_res_add_cookie(res, "theme", "dark");
+    bhttp_res_set_body_text(res, "{\"id\":42,\"name\":\"bittyhttp\",\"tags\":[\"c\",\"http\"]}");
+    return 0;
+}
+
+/* a large payload, built per request or shared by all of them */
+#define BIG_SIZE    65536
+static char big[BIG_SIZE + 1];
+
+static int
+big_text_handler(bhttp_request *req, bhttp_response *res)
+{
+    bstr bs;
+    bstr_init(&bs);
+    bstr_append_cstring(&bs, big, BIG_SIZE);
+    bhttp_res_add_header(res, "content-type", "application/json");
+    bhttp_res_set_body_text(res, bstr_cstring(&bs));
+    bstr_free_contents(&bs);
+    return 0;
+}
+
+static int
+big_move_handler(bhttp_request *req, bhttp_response *res)
+{
+    bstr bs;
+    bstr_init(&bs);
+    bstr_append_cstring(&bs, big, BIG_SIZE);
+    bhttp_res_add_header(res, "content-type", "application/json");
+    bhttp_res_set_body_move(res, &bs);
+    return 0;
+}
+
+static int
+big_static_handler(bhttp_request *req, bhttp_response *res)
+{
+    bhttp_res_add_header(res, "content-type", "application/json");
+    bhttp_res_set_body_static(res, big, BIG_SIZE, NULL, NULL);
+    return 0;
+}
+
+static int
+big_parts_handler(bhttp_request *req, bhttp_response *res)
+{
+    /* a shell around a small dynamic middle, as for a templated page */
+    bstr middle;
+    bstr_init(&middle);
+    bstr_append_cstring(&middle, big, 64);
+    bhttp_res_add_header(res, "content-type", "application/json");
+    bhttp_res_add_body_static(res, big, BIG_SIZE / 2, NULL, NULL);
+    bhttp_res_add_body_move(res, &middle);
+    bhttp_res_add_body_static(res, big, BIG_SIZE / 2 - 64, NULL, NULL);
+    return 0;
+}
+
+static int
+empty_handler(bhttp_request *req, bhttp_response *res)
+{
+    res->response_code = BHTTP_204;
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    const char *request;
+    /* runs rounds / scale times */
+    int scale;
+    int gzip;
+} bench_case;
+
+static const bench_case cases[] = {
+    { "text", "GET /text HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "json+cookies", "GET /json HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "204", "DELETE /empty HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "404", "POST /missing HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "64k text", "GET /big/text HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "64k move", "GET /big/move HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "64k static", "GET /big/static HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "64k parts", "GET /big/parts HTTP/1.1\r\nHost: localhost\r\n\r\n", 1, 0 },
+    { "64k gzip", "GET /big/static HTTP/1.1\r\nHost: localhost\r\n"
+                  "Accept-Encoding: gzip, deflate\r\n\r\n", 100, 1 },
+    { "64k deflate", "GET /big/static HTTP/1.1\r\nHost: localhost\r\n"
+                     "Accept-Encoding: deflate\r\n\r\n", 100, 1 },
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+    int level = argc > 2 ? atoi(argv[2]) : 6;
+
+    bhttp_server *server = bhttp_server_new();
+    if (server == NULL)
+        return 1;
+    bhttp_add_simple_handler(server, BHTTP_GET, "/text", text_handler);
+    bhttp_add_simple_handler(server, BHTTP_GET, "/json", json_handler);
+    bhttp_add_simple_handler(server, BHTTP_DELETE, "/empty", empty_handler);
+    bhttp_add_simple_handler(server, BHTTP_GET, "/big/text", big_text_handler);
+    bhttp_add_simple_handler(server, BHTTP_GET, "/big/move", big_move_handler);
+    bhttp_add_simple_handler(server, BHTTP_GET, "/big/static", big_static_handler);
+    bhttp_add_simple_handler(server, BHTTP_GET, "/big/parts", big_parts_handler);
+    /* records alike enough to compress about as well as real JSON */
+    size_t used = 0;
+    for (int id = 0; used < BIG_SIZE; id++)
+    {
+        int n = snprintf(big + used, BIG_SIZE + 1 - used,
+                         "{\"id\":%d,\"name\":\"user%d\",\"score\":%d,\"active\":%s},",
+                         id, id * 7919 % 100003, id * 37 % 1000, id % 3 ? "true" : "false");
+        used += (size_t)n;
+    }
+    bhttp_compress_opts compress = { level, 1024 };
+    int gzip = bhttp_compress_available() && bhttp_server_set_compression(server, &compress) == 0;
+
+    bhttp_arena arena;
+    bhttp_arena_init(&arena, BHTTP_ARENA_BLOCK_SIZE, NULL);
+
+    printf("%ld rounds\n", rounds);
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++)
+    {
+        if (cases[i].gzip && !gzip)
+            continue;
+        long n = rounds / cases[i].scale;
+        bhttp_readbuf rb;
+        bhttp_request req;
+        bhttp_readbuf_init(&rb);
+        bhttp_request_init(&req);
+        req.server = server;
+        bhttp_readbuf_append(&rb, cases[i].request, strlen(cases[i].request));
+        if (bhttp_request_feed(&req, &rb) != BHTTP_REQ_OK || !req.done)
+        {
+            fprintf(stderr, "%s: request did not parse\n", cases[i].name);
+            return 1;
+        }
+
+        /* never sent, the segments are dropped each round. the request
+         * came from the heap so the arena can be reset under it */
+        bhttp_out out;
+        bhttp_out_init(&out, -1, 0, 1);
+        bhttp_arena *prev = bhttp_arena_use(&arena);
+        size_t queued = 0;
+        double start = now();
+        for (long k = 0; k < n; k++)
+        {
+            bhttp_server_respond(server, &req, &out);
+            queued += bhttp_out_queued(&out);
+            bhttp_out_reset(&out);
+            bhttp_arena_reset(&arena);
+        }
+        double t = now() - start;
+        bhttp_arena_use(prev);
+        if (queued == 0)
+            fprintf(stderr, "%s: nothing was queued\n", cases[i].name);
+        printf("%-13s %8.1f ns/response\n", cases[i].name, t / (double)n * 1e9);
+
+        bhttp_out_free(&out);
+        bhttp_request_free(&req);
+        bhttp_readbuf_free(&rb);
+    }
+
+    bhttp_arena_free(&arena);
+    bhttp_server_free(server);
+    return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ *  arena.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define BLOCK_DATA(b) ((char *)((b) + 1))
+
+/* in front of everything bhttp_malloc hands out */
+typedef struct alloc_head {
+    /* arena block the memory is in, NULL for the heap */
+    bhttp_arena_block *block;
+    /* size asked for, what realloc copies */
+    size_t size;
+} alloc_head;
+#define HEAD(p) ((alloc_head *)(p) - 1)
+
+static __thread bhttp_arena *current = NULL;
+static __thread int heap_only = 0;
+
+static uint64_t heap_count = 0;
+static uint64_t arena_count = 0;
+
+static void *
+heap_malloc(size_t size)
+{
+    __atomic_add_fetch(&heap_count, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+static void *
+heap_realloc(void *p, size_t size)
+{
+    __atomic_add_fetch(&heap_count, 1, __ATOMIC_RELAXED);
+    return realloc(p, size);
+}
+
+static bhttp_arena_block *
+block_new(bhttp_arena *a)
+{
+    bhttp_arena_block *b;
+    bhttp_arena_spares *s = a->spares;
+    if (s != NULL && s->blocks != NULL)
+    {
+        b = s->blocks;
+        s->blocks = b->next;
+        s->count--;
+    }
+    else if ((b = heap_malloc(sizeof(bhttp_arena_block) + a->block_size)) == NULL)
+        return NULL;
+    b->next = b->prev = NULL;
+    b->arena = a;
+    b->size = a->block_size;
+    b->used = 0;
+    b->large = 0;
+    return b;
+}
+
+static void
+block_release(bhttp_arena *a, bhttp_arena_block *b)
+{
+    bhttp_arena_spares *s = a->spares;
+    if (s != NULL && s->count < s->max)
+    {
+        b->next = s->blocks;
+        s->blocks = b;
+        s->count++;
+    }
+    else
+        free(b);
+}
+
+static void
+release_large(bhttp_arena *a)
+{
+    while (a->large != NULL)
+    {
+        bhttp_arena_block *next = a->large->next;
+        free(a->large);
+        a->large = next;
+    }
+}
+
+static void
+flush_stats(bhttp_arena *a)
+{
+    if (a->allocs > 0)
+        __atomic_add_fetch(&arena_count, a->allocs, __ATOMIC_RELAXED);
+    a->allocs = 0;
+}
+
+void
+bhttp_arena_init(bhttp_arena *a, size_t block_size, bhttp_arena_spares *spares)
+{
+    memset(a, 0, sizeof(bhttp_arena));
+    a->block_size = block_size;
+    a->spares = spares;
+}
+
+void
+bhttp_arena_reset(bhttp_arena *a)
+{
+    flush_stats(a);
+    release_large(a);
+    if (a->blocks != NULL)
+    {
+        /* the newest block is the one still in cache */
+        bhttp_arena_block *rest = a->blocks->next;
+        a->blocks->next = NULL;
+        a->blocks->used = 0;
+        while (rest != NULL)
+        {
+            bhttp_arena_block *next = rest->next;
+            block_release(a, rest);
+            rest = next;
+        }
+    }
+    a->last = NULL;
+}
+
+void
+bhttp_arena_free(bhttp_arena *a)
+{
+    flush_stats(a);
+    release_large(a);
+    while (a->blocks != NULL)
+    {
+        bhttp_arena_block *next = a->blocks->next;
+        block_release(a, a->blocks);
+        a->blocks = next;
+    }
+    a->last = NULL;
+}
+
+void
+bhttp_arena_spares_init(bhttp_arena_spares *s, int max)
+{
+    s->blocks = NULL;
+    s->count = 0;
+    s->max = max;
+}
+
+void
+bhttp_arena_spares_free(bhttp_arena_spares *s)
+{
+    while (s->blocks != NULL)
+    {
+        bhttp_arena_block *next = s->blocks->next;
+        free(s->blocks);
+        s->blocks = next;
+    }
+    s->count = 0;
+}
+
+bhttp_arena *
+bhttp_arena_use(bhttp_arena *a)
+{
+    bhttp_arena *prev = current;
+    current = a != NULL && a->block_size > 0 ? a : NULL;
+    return prev;
+}
+
+int
+bhttp_arena_heap_only(int on)
+{
+    int prev = heap_only;
+    heap_only = on;
+    return prev;
+}
+
+static void *
+heap_alloc(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(alloc_head))
+        return NULL;
+    alloc_head *h = heap_malloc(sizeof(alloc_head) + size);
+    if (h == NULL)
+        return NULL;
+    h->block = NULL;
+    h->size = size;
+    return h + 1;
+}
+
+static void *
+arena_alloc(bhttp_arena *a, size_t size)
+{
+    if (size > SIZE_MAX - sizeof(bhttp_arena_block) - sizeof(alloc_head))
+        return NULL;
+    a->allocs++;
+    size_t need = sizeof(alloc_head) + size;
+    alloc_head *h;
+    if (size > a->block_size / 2)
+    {
+        bhttp_arena_block *b = heap_malloc(sizeof(bhttp_arena_block) + need);
+        if (b == NULL)
+            return NULL;
+        b->size = b->used = need;
+        b->large = 1;
+        b->arena = a;
+        b->prev = NULL;
+        if ((b->next = a->large) != NULL)
+            b->next->prev = b;
+        a->large = b;
+        h = (alloc_head *)BLOCK_DATA(b);
+        h->block = b;
+        h->size = size;
+        return h + 1;
+    }
+
+    bhttp_arena_block *b = a->blocks;
+    size_t off = b != NULL ? (b->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) : 0;
+    if (b == NULL || off + need > b->size)
+    {
+        if ((b = block_new(a)) == NULL)
+            return NULL;
+        b->next = a->blocks;
+        a->blocks = b;
+        off = 0;
+    }
+    b->used = off + need;
+    h = (alloc_head *)(BLOCK_DATA(b) + off);
+    h->block = b;
+    h->size = size;
+    a->last = (char *)(h + 1);
+    return a->last;
+}
+
+static void
+large_unlink(bhttp_arena *a, bhttp_arena_block *b)
+{
+    if (b->prev != NULL)
+        b->prev->next = b->next;
+    else
+        a->large = b->next;
+    if (b->next != NULL)
+        b->next->prev = b->prev;
+}
+
+void *
+bhttp_malloc(size_t size)
+{
+    if (current != NULL && !heap_only)
+        return arena_alloc(current, size > 0 ? size : 1);
+    return heap_alloc(size);
+}
+
+void *
+bhttp_calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+    void *p = bhttp_malloc(count * size);
+    if (p != NULL)
+        memset(p, 0, count * size);
+    return p;
+}
+
+void *
+bhttp_realloc(void *p, size_t size)
+{
+    if (p == NULL)
+        return bhttp_malloc(size);
+    if (size > SIZE_MAX - sizeof(bhttp_arena_block) - sizeof(alloc_head))
+        return NULL;
+
+    alloc_head *h = HEAD(p);
+    bhttp_arena_block *b = h->block;
+    if (b == NULL)
+    {
+        if ((h = heap_realloc(h, sizeof(alloc_head) + size)) == NULL)
+            return NULL;
+        h->size = size;
+        return h + 1;
+    }
+
+    bhttp_arena *a = b->arena;
+    if (b->large)
+    {
+        bhttp_arena_block *nb = heap_realloc(b, sizeof(bhttp_arena_block) + sizeof(alloc_head) + size);
+        if (nb == NULL)
+            return NULL;
+        nb->size = nb->used = sizeof(alloc_head) + size;
+        if (nb->prev != NULL)
+            nb->prev->next = nb;
+        else
+            a->large = nb;
+        if (nb->next != NULL)
+            nb->next->prev = nb;
+        h = (alloc_head *)BLOCK_DATA(nb);
+        h->block = nb;
+        h->size = size;
+        return h + 1;
+    }
+
+    /* the most recent allocation can grow where it is */
+    size_t off = (size_t)((char *)p - BLOCK_DATA(b));
+    if (p == a->last && b == a->blocks && !heap_only && off + size <= b->size)
+    {
+        b->used = off + size;
+        h->size = size;
+        return p;
+    }
+
+    void *q = bhttp_malloc(size);
+    if (q == NULL)
+        return NULL;
+    memcpy(q, p, h->size < size ? h->size : size);
+    return q;
+}
+
+void
+bhttp_free(void *p)
+{
+    if (p == NULL)
+        return;
+
+    alloc_head *h = HEAD(p);
+    bhttp_arena_block *b = h->block;
+    if (b == NULL)
+    {
+        free(h);
+        return;
+    }
+
+    bhttp_arena *a = b->arena;
+    if (b->large)
+    {
+        large_unlink(a, b);
+        free(b);
+    }
+    else if (p == a->last && b == a->blocks)
+    {
+        /* freeing the latest allocation hands its space back */
+        b->used = (size_t)((char *)h - BLOCK_DATA(b));
+        a->last = NULL;
+    }
+}
+
+void
+bhttp_alloc_get_stats(bhttp_alloc_stats *stats)
+{
+    stats->requests = 0;
+    stats->heap = __atomic_load_n(&heap_count, __ATOMIC_RELAXED);
+    stats->arena = __atomic_load_n(&arena_count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,98 @@
+/*
+ *  arena.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_ARENA_H
+#define BITTYHTTP_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator owned by a connection and reset between its requests.
+ *
+ * bstr, bvec, headers, cookies and output segments allocate through
+ * bhttp_malloc and friends. Those serve from whatever arena the thread is
+ * using, see bhttp_arena_use, and from the heap otherwise. Freeing arena
+ * memory does nothing, it all goes at the next reset. Every allocation
+ * starts with a small head naming the block it is in, so it can be freed
+ * or resized whichever arena is in use, until its own arena is reset.
+ * Only memory from these functions can be passed to bhttp_free.
+ */
+
+#define BHTTP_ARENA_BLOCK_SIZE  8192
+
+struct bhttp_arena;
+
+typedef struct bhttp_arena_block {
+    struct bhttp_arena_block *next;
+    /* large blocks, the one before in the list so it can be unlinked */
+    struct bhttp_arena_block *prev;
+    /* the arena the block is serving */
+    struct bhttp_arena *arena;
+    size_t size;
+    size_t used;
+    /* holds a single allocation too big for a block */
+    size_t large;
+} bhttp_arena_block;
+
+/* blocks an event loop keeps for its connections, so idle connections
+ * can give theirs back without a later malloc */
+typedef struct bhttp_arena_spares {
+    bhttp_arena_block *blocks;
+    int count;
+    int max;
+} bhttp_arena_spares;
+
+typedef struct bhttp_arena {
+    /* the block allocations come from is first */
+    bhttp_arena_block *blocks;
+    /* allocations too big for a block get one of their own */
+    bhttp_arena_block *large;
+    size_t block_size;
+    bhttp_arena_spares *spares;
+    /* most recent allocation, it can grow in place */
+    char *last;
+    /* allocations served since the last reset */
+    uint64_t allocs;
+} bhttp_arena;
+
+typedef struct bhttp_alloc_stats {
+    /* filled in by bhttp_server_get_alloc_stats, 0 otherwise */
+    uint64_t requests;
+    /* heap calls made by bhttp_malloc and friends, arena blocks included */
+    uint64_t heap;
+    /* allocations served from arenas */
+    uint64_t arena;
+} bhttp_alloc_stats;
+
+/* block_size 0 disables the arena, every allocation goes to the heap */
+void bhttp_arena_init(bhttp_arena *a, size_t block_size, bhttp_arena_spares *spares);
+/* drops everything allocated, keeps one block for the next request */
+void bhttp_arena_reset(bhttp_arena *a);
+/* drops everything and gives all blocks back */
+void bhttp_arena_free(bhttp_arena *a);
+
+void bhttp_arena_spares_init(bhttp_arena_spares *s, int max);
+void bhttp_arena_spares_free(bhttp_arena_spares *s);
+
+/* makes a the arena of the calling thread, NULL for none, returns the previous one */
+bhttp_arena *bhttp_arena_use(bhttp_arena *a);
+/* while on, new allocations come from the heap even with an arena in use,
+ * used around handlers so nothing they keep can outlive a reset.
+ * returns the previous setting */
+int bhttp_arena_heap_only(int on);
+
+void *bhttp_malloc(size_t size);
+void *bhttp_calloc(size_t count, size_t size);
+void *bhttp_realloc(void *p, size_t size);
+void bhttp_free(void *p);
+
+/* totals for the whole process */
+void bhttp_alloc_get_stats(bhttp_alloc_stats *stats);
+
+#endif /* BITTYHTTP_ARENA_H */
@@ -5,14 +5,15 @@
 //
 
 #include "bittystring.h"
+#include "arena.h"
 
 #define C(k, v) [k] = (v),
 static const char * bstr_ret_string[] = { RETURN_CODES };
 #undef C
 
-#define BS_MALLOC(X) malloc(X)
-#define BS_REALLOC(X, Y) realloc((X), (Y))
-#define BS_FREE(X) free(X)
+#define BS_MALLOC(X) bhttp_malloc(X)
+#define BS_REALLOC(X, Y) bhttp_realloc((X), (Y))
+#define BS_FREE(X) bhttp_free(X)
 
 #define SSO_SET_MASK 0x80
 #define SSO_UNSET_MASK 0x7F
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "bittyvec.h"
+#include "arena.h"
 
 void
 bvec_init(bvec* vec, void (*f)(void *d))
@@ -30,13 +31,13 @@ bvec_add(bvec* vec, void* data)
 {
     if(vec->size == 0)
     {
-        vec->data = calloc(10, sizeof(void*));
+        vec->data = bhttp_calloc(10, sizeof(void*));
         vec->capacity = 10;
     }
 
     if(vec->size == vec->capacity)
     {
-        vec->data = realloc(vec->data, vec->capacity * sizeof(void*) * 2);
+        vec->data = bhttp_realloc(vec->data, vec->capacity * sizeof(void*) * 2);
         vec->capacity = vec->capacity * 2;
     }
 
@@ -58,19 +59,19 @@ bvec_free_contents(bvec *vec)
     {
         if (vec->f == NULL)
         {
-            free(vec->data[i]);
+            bhttp_free(vec->data[i]);
         } else {
             vec->f(vec->data[i]);
         }
     }
 
     /* Free array */
-    if (vec->data != NULL) free(vec->data);
+    if (vec->data != NULL) bhttp_free(vec->data);
 }
 
 void
 bvec_free(bvec* vec)
 {
     bvec_free_contents(vec);
-    free(vec);
+    bhttp_free(vec);
 }
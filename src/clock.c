@@ -0,0 +1,115 @@
+/*
+ *  clock.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "clock.h"
+
+/* a seqlock, seq is odd while date is being rewritten */
+static struct {
+    uint32_t seq;
+    time_t now;
+    char date[BHTTP_DATE_LEN];
+} clock_cache;
+
+static const char days[7][3] = {
+    {'S','u','n'}, {'M','o','n'}, {'T','u','e'}, {'W','e','d'},
+    {'T','h','u'}, {'F','r','i'}, {'S','a','t'}
+};
+static const char months[12][3] = {
+    {'J','a','n'}, {'F','e','b'}, {'M','a','r'}, {'A','p','r'},
+    {'M','a','y'}, {'J','u','n'}, {'J','u','l'}, {'A','u','g'},
+    {'S','e','p'}, {'O','c','t'}, {'N','o','v'}, {'D','e','c'}
+};
+
+static void
+put2(char *p, int v)
+{
+    p[0] = (char)('0' + v / 10 % 10);
+    p[1] = (char)('0' + v % 10);
+}
+
+static void
+format_date(time_t now, char *dest)
+/* strftime would follow the locale, the header has to be in English */
+{
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    int year = tm.tm_year + 1900;
+    memcpy(dest, days[tm.tm_wday], 3);
+    memcpy(dest + 3, ", ", 2);
+    put2(dest + 5, tm.tm_mday);
+    dest[7] = ' ';
+    memcpy(dest + 8, months[tm.tm_mon], 3);
+    dest[11] = ' ';
+    put2(dest + 12, year / 100);
+    put2(dest + 14, year);
+    dest[16] = ' ';
+    put2(dest + 17, tm.tm_hour);
+    dest[19] = ':';
+    put2(dest + 20, tm.tm_min);
+    dest[22] = ':';
+    put2(dest + 23, tm.tm_sec);
+    memcpy(dest + 25, " GMT", 4);
+}
+
+static time_t
+read_clock(void)
+{
+    struct timespec ts;
+    /* only whole seconds are wanted, the coarse clock is cheaper to read */
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static void
+refresh(time_t now)
+/* the thread that wins the sequence number rewrites the date, any other
+ * leaves it to that one */
+{
+    uint32_t seq = __atomic_load_n(&clock_cache.seq, __ATOMIC_RELAXED);
+    if (seq & 1)
+        return;
+    if (!__atomic_compare_exchange_n(&clock_cache.seq, &seq, seq + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    format_date(now, clock_cache.date);
+    __atomic_store_n(&clock_cache.now, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock_cache.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+time_t
+bhttp_clock_now(void)
+{
+    return read_clock();
+}
+
+time_t
+bhttp_clock_date(char *dest)
+{
+    time_t now = read_clock();
+    for (int tries = 0; tries < 4; tries++)
+    {
+        uint32_t seq = __atomic_load_n(&clock_cache.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            break;
+        if (__atomic_load_n(&clock_cache.now, __ATOMIC_RELAXED) != now)
+        {
+            refresh(now);
+            continue;
+        }
+        memcpy(dest, clock_cache.date, BHTTP_DATE_LEN);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&clock_cache.seq, __ATOMIC_RELAXED) == seq)
+            return now;
+    }
+    /* another thread is in the middle of an update */
+    format_date(now, dest);
+    return now;
+}
@@ -0,0 +1,31 @@
+/*
+ *  clock.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_CLOCK_H
+#define BITTYHTTP_CLOCK_H
+
+#include <time.h>
+
+/*
+ * Wall clock shared by every thread, read to the second. The Date header
+ * text is formatted once per second by whichever thread first notices the
+ * second has changed, everyone else copies it. Readers never wait: a copy
+ * that raced the update is retried, and one that finds the update still
+ * in progress formats its own.
+ */
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define BHTTP_DATE_LEN  29
+
+/* current unix time in seconds, for logs and cache lifetimes */
+time_t bhttp_clock_now(void);
+/* copies the current time as an RFC 7231 date into dest, which needs room
+ * for BHTTP_DATE_LEN bytes, no NUL is added. returns the time it is for */
+time_t bhttp_clock_date(char *dest);
+
+#endif /* BITTYHTTP_CLOCK_H */
@@ -0,0 +1,253 @@
+/*
+ *  compress.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "compress.h"
+#include "arena.h"
+
+#ifdef ZLIB
+#include <pthread.h>
+#include <zlib.h>
+#endif
+
+static const char *
+skip_ows(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static int
+parse_q(const char *p, const char *end)
+/* a qvalue in thousandths, anything malformed counts as 0 */
+{
+    if (p == end || (*p != '0' && *p != '1'))
+        return 0;
+    int q = (*p++ - '0') * 1000;
+    if (p < end && *p == '.')
+    {
+        p++;
+        for (int scale = 100; scale > 0 && p < end && *p >= '0' && *p <= '9'; scale /= 10)
+            q += (*p++ - '0') * scale;
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+bhttp_encoding
+bhttp_compress_negotiate(const char *accept, size_t len)
+{
+    /* qvalue of gzip, deflate and "*", -1 where not mentioned */
+    int gzip = -1, deflate = -1, any = -1;
+    const char *p = accept;
+    const char *end = accept + len;
+    while (p < end)
+    {
+        const char *next = memchr(p, ',', (size_t)(end - p));
+        if (next == NULL)
+            next = end;
+        p = skip_ows(p, next);
+        const char *name = p;
+        while (p < next && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        size_t name_len = (size_t)(p - name);
+
+        /* only the q parameter matters */
+        int q = 1000;
+        while ((p = memchr(p, ';', (size_t)(next - p))) != NULL)
+        {
+            p = skip_ows(p + 1, next);
+            if (next - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=')
+                q = parse_q(p + 2, next);
+        }
+
+        if ((name_len == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+            (name_len == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+            gzip = q;
+        else if (name_len == 7 && strncasecmp(name, "deflate", 7) == 0)
+            deflate = q;
+        else if (name_len == 1 && *name == '*')
+            any = q;
+        p = next + 1;
+    }
+
+    if (gzip < 0)
+        gzip = any;
+    if (deflate < 0)
+        deflate = any;
+    if (gzip > 0 && gzip >= deflate)
+        return BHTTP_ENC_GZIP;
+    if (deflate > 0)
+        return BHTTP_ENC_DEFLATE;
+    return BHTTP_ENC_IDENTITY;
+}
+
+const char *
+bhttp_encoding_name(bhttp_encoding enc)
+{
+    switch (enc)
+    {
+        case BHTTP_ENC_GZIP:
+            return "gzip";
+        case BHTTP_ENC_DEFLATE:
+            return "deflate";
+        default:
+            return "identity";
+    }
+}
+
+#ifdef ZLIB
+
+/* idle deflate states kept for each coding. a thread-per-connection server
+ * has threads come and go with their clients, so states are shared rather
+ * than tied to a thread, and checked out for one body at a time */
+#define DEFLATER_SPARES 8
+
+typedef struct deflater {
+    struct deflater *next;
+    z_stream zs;
+    int level;
+} deflater;
+
+static pthread_mutex_t deflater_lock = PTHREAD_MUTEX_INITIALIZER;
+static deflater *deflater_spares[2];
+static int deflater_count[2];
+
+static deflater *
+deflater_get(bhttp_encoding enc, int level)
+/* a stream for enc, ready for a new body. it outlives the request, so it
+ * comes from malloc rather than the arena */
+{
+    int i = enc == BHTTP_ENC_GZIP ? 0 : 1;
+    pthread_mutex_lock(&deflater_lock);
+    deflater *d = deflater_spares[i];
+    if (d != NULL)
+    {
+        deflater_spares[i] = d->next;
+        deflater_count[i]--;
+    }
+    pthread_mutex_unlock(&deflater_lock);
+
+    if (d != NULL && d->level == level)
+        return d;
+    if (d != NULL)
+        deflateEnd(&d->zs);
+    else if ((d = malloc(sizeof(deflater))) == NULL)
+        return NULL;
+    memset(&d->zs, 0, sizeof d->zs);
+    /* 16 more window bits asks zlib for the gzip wrapper */
+    int bits = enc == BHTTP_ENC_GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&d->zs, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(d);
+        return NULL;
+    }
+    d->level = level;
+    return d;
+}
+
+static void
+deflater_put(bhttp_encoding enc, deflater *d)
+/* resets d and keeps it for the next body, unless enough are idle */
+{
+    int i = enc == BHTTP_ENC_GZIP ? 0 : 1;
+    if (deflateReset(&d->zs) == Z_OK)
+    {
+        pthread_mutex_lock(&deflater_lock);
+        if (deflater_count[i] < DEFLATER_SPARES)
+        {
+            d->next = deflater_spares[i];
+            deflater_spares[i] = d;
+            deflater_count[i]++;
+            d = NULL;
+        }
+        pthread_mutex_unlock(&deflater_lock);
+    }
+    if (d != NULL)
+    {
+        deflateEnd(&d->zs);
+        free(d);
+    }
+}
+
+int
+bhttp_compress_available(void)
+{
+    return 1;
+}
+
+int
+bhttp_compress(bhttp_encoding enc, int level, const struct iovec *iov, int count, bstr *dest)
+{
+    if (enc == BHTTP_ENC_IDENTITY || count <= 0)
+        return 1;
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += iov[i].iov_len;
+    if (total == 0 || total > UINT_MAX)
+        return 1;
+
+    /* a result that does not fit in the body's own size is not worth it */
+    char *buf = bhttp_malloc(total);
+    if (buf == NULL)
+        return 1;
+    deflater *d = deflater_get(enc, level);
+    if (d == NULL)
+    {
+        bhttp_free(buf);
+        return 1;
+    }
+    z_stream *zs = &d->zs;
+    zs->next_out = (Bytef *)buf;
+    zs->avail_out = (uInt)total;
+
+    int r = Z_OK;
+    for (int i = 0; i < count && r == Z_OK; i++)
+    {
+        zs->next_in = (Bytef *)iov[i].iov_base;
+        zs->avail_in = (uInt)iov[i].iov_len;
+        if (i < count - 1)
+        {
+            r = deflate(zs, Z_NO_FLUSH);
+            /* out of room with input left */
+            if (r == Z_OK && zs->avail_in > 0)
+                r = Z_BUF_ERROR;
+        }
+        else
+            r = deflate(zs, Z_FINISH);
+    }
+    uint64_t len = total - zs->avail_out;
+    deflater_put(enc, d);
+    if (r != Z_STREAM_END)
+    {
+        bhttp_free(buf);
+        return 1;
+    }
+    bstr_replace_move(dest, buf, len);
+    return 0;
+}
+
+#else
+
+int
+bhttp_compress_available(void)
+{
+    return 0;
+}
+
+int
+bhttp_compress(bhttp_encoding enc, int level, const struct iovec *iov, int count, bstr *dest)
+{
+    return 1;
+}
+
+#endif /* ZLIB */
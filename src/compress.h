@@ -0,0 +1,41 @@
+/*
+ *  compress.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_COMPRESS_H
+#define BITTYHTTP_COMPRESS_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "bittystring.h"
+
+/*
+ * gzip and deflate content codings for response bodies, with zlib when
+ * built with `make ZLIB=1`. Deflate states are reset after each response
+ * and a few are kept idle for each coding, shared by all threads, so the
+ * window and hash tables zlib needs are not set up for every response.
+ */
+
+typedef enum {
+    BHTTP_ENC_IDENTITY = 0,
+    BHTTP_ENC_GZIP,
+    BHTTP_ENC_DEFLATE
+} bhttp_encoding;
+
+/* the coding to answer with for an accept-encoding value, gzip when both
+ * are as welcome. identity if neither is accepted */
+bhttp_encoding bhttp_compress_negotiate(const char *accept, size_t len);
+/* the content-encoding value for enc */
+const char *bhttp_encoding_name(bhttp_encoding enc);
+/* 1 if bhttp_compress can do anything, that is zlib was built in */
+int bhttp_compress_available(void);
+/* compresses the count buffers of iov, in order, into dest at level 1 to
+ * 9. returns 1 if it failed or the result would not be smaller */
+int bhttp_compress(bhttp_encoding enc, int level, const struct iovec *iov, int count, bstr *dest);
+
+#endif /* BITTYHTTP_COMPRESS_H */
@@ -5,13 +5,14 @@
 #include "cookie.h"
 #include "bittystring.h"
 #include "bittyvec.h"
+#include "arena.h"
 
 void
 bhttp_cookie_entry_free(bhttp_cookie_entry * ce)
 {
     bstr_free_contents(&(ce->field));
     bstr_free_contents(&(ce->value));
-    free(ce);
+    bhttp_free(ce);
 }
 
 typedef struct bhttp_cookie {
@@ -21,10 +22,10 @@ typedef struct bhttp_cookie {
 bhttp_cookie *
 bhttp_cookie_new()
 {
-    bhttp_cookie * c = malloc(sizeof(bhttp_cookie));
+    bhttp_cookie * c = bhttp_malloc(sizeof(bhttp_cookie));
     if (c == NULL)
         return NULL;
-    c->entries = malloc(sizeof(bvec));
+    c->entries = bhttp_malloc(sizeof(bvec));
 
     bvec_init(c->entries, (void (*)(void *)) &bhttp_cookie_entry_free);
 
@@ -41,13 +42,13 @@ void
 bhttp_cookie_free(bhttp_cookie * c)
 {
     bhttp_cookie_free_contents(c);
-    free(c);
+    bhttp_free(c);
 }
 
 int
 bhttp_cookie_parse(bhttp_cookie * c, const char * s)
 {
-    bhttp_cookie_entry * ce = malloc(sizeof(bhttp_cookie_entry));
+    bhttp_cookie_entry * ce = bhttp_malloc(sizeof(bhttp_cookie_entry));
     bstr_init(&ce->field);
     bstr_init(&ce->value);
 
@@ -77,7 +78,7 @@ bhttp_cookie_parse(bhttp_cookie * c, const char * s)
             if (current_state == DELIM)
             {
                 bvec_add(c->entries, ce);
-                ce = malloc(sizeof(bhttp_cookie_entry));
+                ce = bhttp_malloc(sizeof(bhttp_cookie_entry));
                 bstr_init(&ce->field);
                 bstr_init(&ce->value);
                 current_state = FIELD;
@@ -105,7 +106,9 @@ bhttp_cookie_parse(bhttp_cookie * c, const char * s)
     return 0;
 
     bad:
-    bhttp_cookie_free_contents(c);
+    /* drop what was parsed, c itself stays usable */
+    bvec_free_contents(c->entries);
+    bvec_init(c->entries, (void (*)(void *)) &bhttp_cookie_entry_free);
     bhttp_cookie_entry_free(ce);
     return 1;
 }
@@ -113,7 +116,7 @@ bhttp_cookie_parse(bhttp_cookie * c, const char * s)
 int
 bhttp_cookie_add_entry(bhttp_cookie * c, const char * field, const char * value)
 {
-    bhttp_cookie_entry * ce = malloc(sizeof(bhttp_cookie_entry));
+    bhttp_cookie_entry * ce = bhttp_malloc(sizeof(bhttp_cookie_entry));
     if (ce == NULL)
         return 1;
     bstr_init(&ce->field);
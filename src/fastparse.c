@@ -0,0 +1,239 @@
+/*
+ *  fastparse.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include "fastparse.h"
+
+/* header name characters, RFC 7230 tchar */
+static const char token_tbl[256] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#define IS_URI_END(c)   ((unsigned char)(c) <= ' ' || (c) == '\177')
+#define IS_VALUE_END(c) (((unsigned char)(c) < ' ' && (c) != '\t') || (c) == '\177')
+
+#if defined(__SSE4_2__)
+static const char *
+find_range(const char *p, const char *end, const char *ranges, int ranges_len)
+/* skips 16 bytes at a time until one falls in ranges, the caller finishes the tail */
+{
+    __m128i r = _mm_loadu_si128((const __m128i *)ranges);
+    while (end - p >= 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *)p);
+        int i = _mm_cmpestri(r, ranges_len, b, 16,
+                             _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+        if (i != 16)
+            return p + i;
+        p += 16;
+    }
+    return p;
+}
+#endif
+
+static const char *
+find_uri_end(const char *p, const char *end)
+/* first space, control character or DEL */
+{
+#if defined(__AVX2__)
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8('\177');
+    while (end - p >= 32)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i *)p);
+        /* unsigned b <= ' ' */
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_min_epu8(b, sp), b);
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(b, del));
+        unsigned m = (unsigned)_mm256_movemask_epi8(stop);
+        if (m != 0)
+            return p + __builtin_ctz(m);
+        p += 32;
+    }
+#elif defined(__SSE4_2__)
+    static const char ranges[16] = "\000\040\177\177";
+    p = find_range(p, end, ranges, 4);
+#endif
+    while (p < end && !IS_URI_END(*p))
+        p++;
+    return p;
+}
+
+static const char *
+find_value_end(const char *p, const char *end)
+/* first control character other than tab, or DEL */
+{
+#if defined(__AVX2__)
+    const __m256i us = _mm256_set1_epi8('\037');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8('\177');
+    while (end - p >= 32)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i *)p);
+        /* unsigned b < ' ', except tab */
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_min_epu8(b, us), b);
+        stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(b, tab), stop);
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(b, del));
+        unsigned m = (unsigned)_mm256_movemask_epi8(stop);
+        if (m != 0)
+            return p + __builtin_ctz(m);
+        p += 32;
+    }
+#elif defined(__SSE4_2__)
+    static const char ranges[16] = "\000\010\012\037\177\177";
+    p = find_range(p, end, ranges, 6);
+#endif
+    while (p < end && !IS_VALUE_END(*p))
+        p++;
+    return p;
+}
+
+static const char *
+find_token_end(const char *p, const char *end)
+/* first character that is not allowed in a header name */
+{
+#if defined(__SSE4_2__)
+    /* skips the common characters, the table below has the final say */
+    static const char ranges[16] = "\000\040\"\"(),,//:@[]{\377";
+    p = find_range(p, end, ranges, 16);
+#endif
+    while (p < end && token_tbl[(unsigned char)*p])
+        p++;
+    return p;
+}
+
+static int
+parse_eol(const char **pp, const char *end)
+/* steps *pp over a CRLF or LF, returns 0 if it did, BHTTP_FAST_INCOMPLETE if
+ * the buffer ends first or BHTTP_FAST_INVALID if there is no line end */
+{
+    const char *p = *pp;
+    if (p == end)
+        return BHTTP_FAST_INCOMPLETE;
+    if (*p == '\r')
+    {
+        if (++p == end)
+            return BHTTP_FAST_INCOMPLETE;
+        if (*p != '\n')
+            return BHTTP_FAST_INVALID;
+    }
+    else if (*p != '\n')
+        return BHTTP_FAST_INVALID;
+    *pp = p + 1;
+    return 0;
+}
+
+int
+bhttp_fast_parse_head(const char *buf, size_t len, bhttp_fast_head *head)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    size_t max_headers = head->num_headers;
+    head->num_headers = 0;
+
+    /* empty lines before the request line are allowed */
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+
+    /* method */
+    head->method = p;
+    p = find_token_end(p, end);
+    if (p == end) return BHTTP_FAST_INCOMPLETE;
+    if (*p != ' ' || p == head->method) return BHTTP_FAST_INVALID;
+    head->method_len = (size_t)(p - head->method);
+
+    /* request target */
+    head->uri = ++p;
+    p = find_uri_end(p, end);
+    if (p == end) return BHTTP_FAST_INCOMPLETE;
+    if (*p != ' ' || p == head->uri) return BHTTP_FAST_INVALID;
+    head->uri_len = (size_t)(p - head->uri);
+
+    /* version, only HTTP/1.x */
+    p++;
+    if (end - p < 8) return BHTTP_FAST_INCOMPLETE;
+    if (p[0] != 'H' || p[1] != 'T' || p[2] != 'T' || p[3] != 'P' ||
+        p[4] != '/' || p[5] != '1' || p[6] != '.' || p[7] < '0' || p[7] > '9')
+        return BHTTP_FAST_INVALID;
+    head->minor_version = p[7] - '0';
+    p += 8;
+    int r = parse_eol(&p, end);
+    if (r != 0) return r;
+
+    /* headers, until the empty line */
+    while (1)
+    {
+        if (p == end) return BHTTP_FAST_INCOMPLETE;
+        if (*p == '\r' || *p == '\n')
+        {
+            if ((r = parse_eol(&p, end)) != 0)
+                return r;
+            return (int)(p - buf);
+        }
+
+        /* folded lines are left to http_parser */
+        if (*p == ' ' || *p == '\t' || head->num_headers == max_headers)
+            return BHTTP_FAST_INVALID;
+
+        bhttp_fast_header *h = &head->headers[head->num_headers];
+        h->name = p;
+        p = find_token_end(p, end);
+        if (p == end) return BHTTP_FAST_INCOMPLETE;
+        if (*p != ':' || p == h->name) return BHTTP_FAST_INVALID;
+        h->name_len = (size_t)(p - h->name);
+
+        /* value without the whitespace around it */
+        p++;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        h->value = p;
+        p = find_value_end(p, end);
+        if (p == end) return BHTTP_FAST_INCOMPLETE;
+        const char *value_end = p;
+        while (value_end > h->value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+        h->value_len = (size_t)(value_end - h->value);
+
+        if ((r = parse_eol(&p, end)) != 0)
+            return r;
+        head->num_headers++;
+    }
+}
+
+const char *
+bhttp_fast_parse_engine(void)
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE4_2__)
+    return "sse4.2";
+#else
+    return "scalar";
+#endif
+}
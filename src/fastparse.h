@@ -0,0 +1,52 @@
+/*
+ *  fastparse.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_FASTPARSE_H
+#define BITTYHTTP_FASTPARSE_H
+
+#include <stddef.h>
+
+/*
+ * One pass request head parser in the style of picohttpparser. It scans
+ * for delimiters 32 or 16 bytes at a time with AVX2 or SSE4.2 when the
+ * compiler targets them, and a byte at a time otherwise. Nothing is
+ * copied, every string points into the buffer that was parsed.
+ */
+
+#define BHTTP_FAST_INVALID      -1
+#define BHTTP_FAST_INCOMPLETE   -2
+
+typedef struct bhttp_fast_header {
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} bhttp_fast_header;
+
+typedef struct bhttp_fast_head {
+    const char *method;
+    size_t method_len;
+    const char *uri;
+    size_t uri_len;
+    /* the x in HTTP/1.x */
+    int minor_version;
+    bhttp_fast_header *headers;
+    /* size of headers on input, headers found on output */
+    size_t num_headers;
+} bhttp_fast_head;
+
+/* parses a request line and headers up to and including the empty line
+ * returns the length of the head, BHTTP_FAST_INCOMPLETE if buf ends before
+ * it does or BHTTP_FAST_INVALID for anything it does not handle, including
+ * folded header lines and more than num_headers headers */
+int bhttp_fast_parse_head(const char *buf, size_t len, bhttp_fast_head *head);
+
+/* name of the scanner that was compiled in: "avx2", "sse4.2" or "scalar" */
+const char *bhttp_fast_parse_engine(void);
+
+#endif /* BITTYHTTP_FASTPARSE_H */
@@ -6,12 +6,48 @@
  *  Copyright (c) 2021 Colin Luoma. All rights reserved.
  */
 
+#include <strings.h>
 #include "header.h"
+#include "arena.h"
+
+#define K(k, v) { v, sizeof(v) - 1 },
+static const struct {
+    const char *name;
+    size_t len;
+} known_names[] = { BHTTP_KNOWN_HEADERS };
+#undef K
+
+/*
+ * Perfect hash over BHTTP_KNOWN_HEADERS, every name has a slot of its own
+ * for KNOWN_HASH. The table holds the header + 1, 0 for empty slots, and
+ * needs new multipliers if it collides after the list changes, `make test`
+ * checks that every name still finds itself.
+ */
+#define KNOWN_HASH(s, len) (((len) + 17 * ((unsigned char)(s)[0] | 0x20) + \
+                             23 * ((unsigned char)(s)[(len) - 1] | 0x20)) & 63)
+static const unsigned char known_slots[64] = {
+        BHTTP_H_X_REQUEST_ID + 1, BHTTP_H_ACCEPT_ENCODING + 1, 0, 0,
+        0, BHTTP_H_X_FORWARDED_FOR + 1, BHTTP_H_TRANSFER_ENCODING + 1, BHTTP_H_ORIGIN + 1,
+        0, BHTTP_H_TE + 1, 0, 0,
+        0, 0, 0, 0,
+        0, BHTTP_H_X_REAL_IP + 1, 0, BHTTP_H_ACCEPT_LANGUAGE + 1,
+        BHTTP_H_CACHE_CONTROL + 1, 0, 0, BHTTP_H_REFERER + 1,
+        BHTTP_H_HOST + 1, 0, 0, 0,
+        0, BHTTP_H_IF_MODIFIED_SINCE + 1, BHTTP_H_IF_NONE_MATCH + 1, BHTTP_H_UPGRADE + 1,
+        BHTTP_H_AUTHORIZATION + 1, 0, 0, BHTTP_H_ACCEPT + 1,
+        BHTTP_H_CONTENT_ENCODING + 1, 0, 0, BHTTP_H_EXPECT + 1,
+        0, 0, BHTTP_H_RANGE + 1, 0,
+        BHTTP_H_COOKIE + 1, BHTTP_H_PRAGMA + 1, 0, 0,
+        0, 0, BHTTP_H_CONTENT_TYPE + 1, 0,
+        0, 0, 0, 0,
+        BHTTP_H_KEEP_ALIVE + 1, BHTTP_H_CONTENT_LENGTH + 1, 0, BHTTP_H_USER_AGENT + 1,
+        0, 0, 0, BHTTP_H_CONNECTION + 1
+};
 
 bhttp_header *
 bhttp_header_new()
 {
-    bhttp_header *h = malloc(sizeof(bhttp_header));
+    bhttp_header *h = bhttp_malloc(sizeof(bhttp_header));
     if (h == NULL)
         return NULL;
     bstr_init(&(h->field));
@@ -24,7 +60,7 @@ bhttp_header_free(bhttp_header *h)
 {
     bstr_free_contents(&(h->field));
     bstr_free_contents(&(h->value));
-    free(h);
+    bhttp_free(h);
 }
 
 int
@@ -73,4 +109,15 @@ bhttp_header_name_verify(const char *hfn)
         c = *(++hfn);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+int
+bhttp_header_known(const char *field, size_t len)
+{
+    if (len == 0)
+        return BHTTP_H_UNKNOWN;
+    int k = known_slots[KNOWN_HASH(field, len)] - 1;
+    if (k < 0 || known_names[k].len != len || strncasecmp(known_names[k].name, field, len) != 0)
+        return BHTTP_H_UNKNOWN;
+    return k;
+}
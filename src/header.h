@@ -11,6 +11,38 @@
 
 #include "bittystring.h"
 
+/* request headers the parser recognises, see bhttp_req_get_known_header */
+#define BHTTP_KNOWN_HEADERS K(BHTTP_H_HOST, "host")                            \
+                            K(BHTTP_H_CONNECTION, "connection")                \
+                            K(BHTTP_H_CONTENT_LENGTH, "content-length")        \
+                            K(BHTTP_H_CONTENT_TYPE, "content-type")            \
+                            K(BHTTP_H_TRANSFER_ENCODING, "transfer-encoding")  \
+                            K(BHTTP_H_ACCEPT, "accept")                        \
+                            K(BHTTP_H_ACCEPT_ENCODING, "accept-encoding")      \
+                            K(BHTTP_H_ACCEPT_LANGUAGE, "accept-language")      \
+                            K(BHTTP_H_AUTHORIZATION, "authorization")          \
+                            K(BHTTP_H_COOKIE, "cookie")                        \
+                            K(BHTTP_H_USER_AGENT, "user-agent")                \
+                            K(BHTTP_H_REFERER, "referer")                      \
+                            K(BHTTP_H_ORIGIN, "origin")                        \
+                            K(BHTTP_H_IF_NONE_MATCH, "if-none-match")          \
+                            K(BHTTP_H_IF_MODIFIED_SINCE, "if-modified-since")  \
+                            K(BHTTP_H_RANGE, "range")                          \
+                            K(BHTTP_H_EXPECT, "expect")                        \
+                            K(BHTTP_H_UPGRADE, "upgrade")                      \
+                            K(BHTTP_H_CACHE_CONTROL, "cache-control")          \
+                            K(BHTTP_H_X_FORWARDED_FOR, "x-forwarded-for")      \
+                            K(BHTTP_H_X_REAL_IP, "x-real-ip")                  \
+                            K(BHTTP_H_X_REQUEST_ID, "x-request-id")            \
+                            K(BHTTP_H_CONTENT_ENCODING, "content-encoding")    \
+                            K(BHTTP_H_TE, "te")                                \
+                            K(BHTTP_H_KEEP_ALIVE, "keep-alive")                \
+                            K(BHTTP_H_PRAGMA, "pragma")
+#define K(k, v) k,
+typedef enum { BHTTP_KNOWN_HEADERS BHTTP_H_COUNT } bhttp_known_header;
+#undef K
+#define BHTTP_H_UNKNOWN -1
+
 typedef struct bhttp_header {
     bstr field;
     bstr value;
@@ -23,5 +55,7 @@ typedef struct bhttp_headers {
 bhttp_header * bhttp_header_new();
 void bhttp_header_free(bhttp_header *h);
 int bhttp_header_name_verify(const char *hfn);
+/* returns the bhttp_known_header for a field name in any case, or BHTTP_H_UNKNOWN */
+int bhttp_header_known(const char *field, size_t len);
 
 #endif //BITTYHTTP_HEADER_H
@@ -16,19 +16,25 @@
 typedef struct {
     char *ext; // File extension
     char *med; // Media type
+    int compressed; // Already compressed, gzip would not shrink it
 } http_mime;
 
 static http_mime http_mime_types[] = {
-    {"txt", "text/plain"},
-    {"jpg", "image/jpg"},
-    {"jpeg", "image/jpg"},
-    {"gif", "image/gif"},
-    {"png", "image/png"},
-    {"html", "text/html"},
-    {"htm", "text/html"},
-    {"css", "text/css"},
-    {"js", "text/javascript"},
-    {"zip", "application/zip"}
+    {"txt", "text/plain", 0},
+    {"jpg", "image/jpg", 1},
+    {"jpeg", "image/jpg", 1},
+    {"gif", "image/gif", 1},
+    {"png", "image/png", 1},
+    {"webp", "image/webp", 1},
+    {"svg", "image/svg+xml", 0},
+    {"html", "text/html", 0},
+    {"htm", "text/html", 0},
+    {"css", "text/css", 0},
+    {"js", "text/javascript", 0},
+    {"json", "application/json", 0},
+    {"woff2", "font/woff2", 1},
+    {"gz", "application/gzip", 1},
+    {"zip", "application/zip", 1}
 };
 
 const char *
@@ -44,3 +50,22 @@ mime_from_ext(char *ext)
     
     return "application/octet-stream";
 }
+
+int
+mime_is_compressed(const char *type)
+{
+    /* the media type ends at its parameters */
+    size_t len = strcspn(type, "; \t");
+    /* unknown binary data is taken to be incompressible */
+    if (len == 24 && strncasecmp(type, "application/octet-stream", len) == 0)
+        return 1;
+    for (size_t i = 0; i < ARRAY_SIZE(http_mime_types); i++)
+    {
+        if (strlen(http_mime_types[i].med) == len &&
+            strncasecmp(type, http_mime_types[i].med, len) == 0)
+        {
+            return http_mime_types[i].compressed;
+        }
+    }
+    return 0;
+}
@@ -13,5 +13,8 @@
 #include <string.h>
 
 const char * mime_from_ext(char *ext);
+/* 1 for media types whose data is compressed already, such as images and
+ * archives, parameters after the type are ignored */
+int mime_is_compressed(const char *type);
 
 #endif /* BITTYHTTP_MIME_TYPES_H */
@@ -0,0 +1,414 @@
+/*
+ *  multipart.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "request.h"
+#include "respond.h"
+#include "arena.h"
+
+enum {
+    MP_PREAMBLE = 0,
+    MP_HEADERS,
+    MP_DATA,
+    /* after a delimiter, CRLF starts a part and "--" ends the body */
+    MP_DELIM,
+    MP_DELIM_CR,
+    MP_DELIM_DASH,
+    MP_EPILOGUE
+};
+
+static void
+part_init(bhttp_part *part, int index)
+{
+    part->headers = NULL;
+    part->headers_len = 0;
+    bstr_init(&part->name);
+    bstr_init(&part->filename);
+    bstr_init(&part->content_type);
+    part->index = index;
+    part->size = 0;
+    part->fd = -1;
+}
+
+static void
+part_free(bhttp_part *part)
+{
+    bstr_free_contents(&part->name);
+    bstr_free_contents(&part->filename);
+    bstr_free_contents(&part->content_type);
+    if (part->fd >= 0)
+        close(part->fd);
+    part->fd = -1;
+}
+
+static int
+param_value(const char *p, const char *end, const char *key, bstr *dest)
+/* finds key=value in a header's ; separated parameters, the value may be quoted
+ * returns 1 if it is not there */
+{
+    size_t key_len = strlen(key);
+    while (p < end)
+    {
+        const char *semi = memchr(p, ';', (size_t)(end - p));
+        p = semi != NULL ? semi + 1 : end;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if ((size_t)(end - p) <= key_len || strncasecmp(p, key, key_len) != 0 || p[key_len] != '=')
+            continue;
+
+        p += key_len + 1;
+        if (p < end && *p == '"')
+        {
+            /* quoted-string, a backslash escapes the next character */
+            for (p++; p < end && *p != '"'; p++)
+            {
+                if (*p == '\\' && p + 1 < end)
+                    p++;
+                if (bstr_append_char(dest, *p) != BS_SUCCESS)
+                    return 1;
+            }
+            return 0;
+        }
+        const char *v = p;
+        while (p < end && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        return bstr_append_cstring(dest, v, (uint64_t)(p - v)) != BS_SUCCESS;
+    }
+    return 1;
+}
+
+static void
+parse_part_headers(bhttp_part *part)
+/* picks the fields handlers usually want out of the part's header block */
+{
+    const char *p = part->headers;
+    const char *end = p + part->headers_len;
+    while (p < end)
+    {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = eol != NULL ? eol : end;
+        const char *colon = memchr(p, ':', (size_t)(line_end - p));
+        if (colon != NULL)
+        {
+            const char *v = colon + 1;
+            const char *v_end = line_end;
+            while (v < v_end && (*v == ' ' || *v == '\t'))
+                v++;
+            while (v_end > v && (v_end[-1] == '\r' || v_end[-1] == ' ' || v_end[-1] == '\t'))
+                v_end--;
+            size_t name_len = (size_t)(colon - p);
+            if (name_len == 19 && strncasecmp(p, "content-disposition", 19) == 0)
+            {
+                param_value(v, v_end, "name", &part->name);
+                param_value(v, v_end, "filename", &part->filename);
+            }
+            else if (name_len == 12 && strncasecmp(p, "content-type", 12) == 0)
+                bstr_append_cstring(&part->content_type, v, (uint64_t)(v_end - v));
+        }
+        p = line_end + 1;
+    }
+}
+
+int
+bhttp_multipart_init(bhttp_multipart *mp, const char *content_type, size_t len,
+                     const bhttp_multipart_opts *opts)
+{
+    const char *end = content_type + len;
+    if (len < 10 || strncasecmp(content_type, "multipart/", 10) != 0)
+        return 1;
+
+    bstr boundary;
+    bstr_init(&boundary);
+    if (param_value(content_type, end, "boundary", &boundary) != 0 ||
+        bstr_size(&boundary) == 0 || bstr_size(&boundary) > BHTTP_BOUNDARY_MAX)
+    {
+        bstr_free_contents(&boundary);
+        return 1;
+    }
+
+    memset(mp, 0, sizeof *mp);
+    mp->opts = *opts;
+    mp->state = MP_PREAMBLE;
+    part_init(&mp->part, 0);
+    memcpy(mp->delim, "\r\n--", 4);
+    memcpy(mp->delim + 4, bstr_cstring(&boundary), (size_t)bstr_size(&boundary));
+    mp->delim_len = 4 + (size_t)bstr_size(&boundary);
+    bstr_free_contents(&boundary);
+
+    for (int i = 0; i < 256; i++)
+        mp->shift[i] = (unsigned char)mp->delim_len;
+    for (size_t i = 0; i + 1 < mp->delim_len; i++)
+        mp->shift[(unsigned char)mp->delim[i]] = (unsigned char)(mp->delim_len - 1 - i);
+
+    /* the first delimiter may open the body, as if a line ended before it */
+    memcpy(mp->hold, "\r\n", 2);
+    mp->hold_len = 2;
+    return 0;
+}
+
+void
+bhttp_multipart_free(bhttp_multipart *mp)
+{
+    part_free(&mp->part);
+    bhttp_free(mp->head);
+    mp->head = NULL;
+}
+
+int
+bhttp_multipart_complete(const bhttp_multipart *mp)
+{
+    return mp->state == MP_EPILOGUE;
+}
+
+static const char *
+find_delim(const bhttp_multipart *mp, const char *p, const char *end)
+/* Horspool search, NULL if the whole delimiter is not in p..end */
+{
+    size_t n = mp->delim_len;
+    unsigned char last = (unsigned char)mp->delim[n - 1];
+    while ((size_t)(end - p) >= n)
+    {
+        unsigned char c = (unsigned char)p[n - 1];
+        if (c == last && memcmp(p, mp->delim, n - 1) == 0)
+            return p;
+        p += mp->shift[c];
+    }
+    return NULL;
+}
+
+static size_t
+partial_delim(const bhttp_multipart *mp, const char *p, const char *end)
+/* length of the longest tail of p..end that a delimiter could start with */
+{
+    size_t max = mp->delim_len - 1;
+    const char *s = (size_t)(end - p) > max ? end - max : p;
+    for (; s < end; s++)
+    {
+        if (*s == '\r' && memcmp(s, mp->delim, (size_t)(end - s)) == 0)
+            return (size_t)(end - s);
+    }
+    return 0;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+run_cb(int (*cb)(struct bhttp_request *, bhttp_part *, void *), struct bhttp_request *req,
+       bhttp_multipart *mp)
+{
+    if (cb == NULL)
+        return 0;
+    int heap = bhttp_arena_heap_only(1);
+    int r = cb(req, &mp->part, mp->opts.arg);
+    bhttp_arena_heap_only(heap);
+    return r != 0 ? BHTTP_400 : 0;
+}
+
+static int
+part_data(bhttp_multipart *mp, struct bhttp_request *req, const char *data, size_t len)
+{
+    /* anything before the first delimiter is ignored */
+    if (len == 0 || mp->state != MP_DATA)
+        return 0;
+    bhttp_part *part = &mp->part;
+    part->size += len;
+    if (mp->opts.max_part_size > 0 && part->size > mp->opts.max_part_size)
+        return BHTTP_413;
+    if (part->fd >= 0)
+        return write_all(part->fd, data, len) != 0 ? BHTTP_500 : 0;
+    if (mp->opts.on_data == NULL)
+        return 0;
+    int heap = bhttp_arena_heap_only(1);
+    int r = mp->opts.on_data(req, part, data, len, mp->opts.arg);
+    bhttp_arena_heap_only(heap);
+    return r != 0 ? BHTTP_400 : 0;
+}
+
+static int
+delim_found(bhttp_multipart *mp, struct bhttp_request *req)
+{
+    int r = 0;
+    if (mp->state == MP_DATA)
+    {
+        r = run_cb(mp->opts.on_part_end, req, mp);
+        int index = mp->part.index;
+        part_free(&mp->part);
+        part_init(&mp->part, index + 1);
+    }
+    mp->state = MP_DELIM;
+    return r;
+}
+
+static int
+scan_data(bhttp_multipart *mp, struct bhttp_request *req, const char **pp, const char *end)
+/* passes on data up to the next delimiter, or all of it keeping back a
+ * tail the next fragment has to decide about */
+{
+    const char *p = *pp;
+    size_t len = (size_t)(end - p);
+    int r;
+
+    /* a delimiter may have started at the end of the previous fragment */
+    for (size_t k = 0; k < mp->hold_len; k++)
+    {
+        size_t tail = mp->hold_len - k;
+        if (mp->hold[k] != '\r' || memcmp(mp->hold + k, mp->delim, tail) != 0)
+            continue;
+        size_t need = mp->delim_len - tail;
+        size_t cmp = need < len ? need : len;
+        if (memcmp(p, mp->delim + tail, cmp) != 0)
+            continue;
+        if ((r = part_data(mp, req, mp->hold, k)) != 0)
+            return r;
+        if (cmp < need)
+        {
+            /* still undecided */
+            memmove(mp->hold, mp->hold + k, tail);
+            memcpy(mp->hold + tail, p, len);
+            mp->hold_len = tail + len;
+            *pp = end;
+            return 0;
+        }
+        mp->hold_len = 0;
+        *pp = p + need;
+        return delim_found(mp, req);
+    }
+    if (mp->hold_len > 0)
+    {
+        size_t held = mp->hold_len;
+        mp->hold_len = 0;
+        if ((r = part_data(mp, req, mp->hold, held)) != 0)
+            return r;
+    }
+
+    const char *d = find_delim(mp, p, end);
+    if (d != NULL)
+    {
+        if ((r = part_data(mp, req, p, (size_t)(d - p))) != 0)
+            return r;
+        *pp = d + mp->delim_len;
+        return delim_found(mp, req);
+    }
+    size_t keep = partial_delim(mp, p, end);
+    if ((r = part_data(mp, req, p, len - keep)) != 0)
+        return r;
+    memcpy(mp->hold, end - keep, keep);
+    mp->hold_len = keep;
+    *pp = end;
+    return 0;
+}
+
+static int
+scan_headers(bhttp_multipart *mp, struct bhttp_request *req, const char **pp, const char *end)
+/* collects the part's header block, up to the empty line */
+{
+    size_t old = mp->head_len;
+    size_t len = (size_t)(end - *pp);
+    if (len > BHTTP_PART_HEAD_MAX - old)
+        len = BHTTP_PART_HEAD_MAX - old;
+    if (old + len > mp->head_cap)
+    {
+        size_t cap = mp->head_cap ? mp->head_cap : 256;
+        while (cap < old + len)
+            cap *= 2;
+        char *head = bhttp_realloc(mp->head, cap);
+        if (head == NULL)
+            return BHTTP_500;
+        mp->head = head;
+        mp->head_cap = cap;
+    }
+    memcpy(mp->head + old, *pp, len);
+    mp->head_len = old + len;
+
+    /* a part without headers starts with the empty line */
+    size_t block = 0;
+    if (mp->head_len >= 2 && mp->head[0] == '\r' && mp->head[1] == '\n')
+        block = 2;
+    for (size_t i = old > 3 ? old - 3 : 0; block == 0 && i + 4 <= mp->head_len; i++)
+    {
+        if (memcmp(mp->head + i, "\r\n\r\n", 4) == 0)
+            block = i + 4;
+    }
+    if (block == 0)
+    {
+        *pp += len;
+        return mp->head_len < BHTTP_PART_HEAD_MAX ? 0 : BHTTP_400;
+    }
+
+    *pp += block - old;
+    mp->head_len = 0;
+    mp->part.headers = mp->head;
+    mp->part.headers_len = block;
+    parse_part_headers(&mp->part);
+    mp->state = MP_DATA;
+    return run_cb(mp->opts.on_part, req, mp);
+}
+
+int
+bhttp_multipart_feed(bhttp_multipart *mp, struct bhttp_request *req, const char *data, size_t len)
+{
+    const char *p = data;
+    const char *end = data + len;
+    int r = 0;
+    while (p < end && r == 0)
+    {
+        switch (mp->state)
+        {
+            case MP_PREAMBLE:
+            case MP_DATA:
+                r = scan_data(mp, req, &p, end);
+                break;
+            case MP_HEADERS:
+                r = scan_headers(mp, req, &p, end);
+                break;
+            case MP_DELIM:
+                /* whitespace is allowed before the line ends */
+                if (*p == '-')
+                    mp->state = MP_DELIM_DASH;
+                else if (*p == '\r')
+                    mp->state = MP_DELIM_CR;
+                else if (*p != ' ' && *p != '\t')
+                    r = BHTTP_400;
+                p++;
+                break;
+            case MP_DELIM_CR:
+                if (*p++ != '\n')
+                    r = BHTTP_400;
+                mp->state = MP_HEADERS;
+                break;
+            case MP_DELIM_DASH:
+                if (*p++ != '-')
+                    r = BHTTP_400;
+                mp->state = MP_EPILOGUE;
+                break;
+            case MP_EPILOGUE:
+                p = end;
+                break;
+        }
+    }
+    return r;
+}
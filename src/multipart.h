@@ -0,0 +1,91 @@
+/*
+ *  multipart.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_MULTIPART_H
+#define BITTYHTTP_MULTIPART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bittystring.h"
+
+/*
+ * Streaming multipart/form-data parser, fed the request body as it
+ * arrives. Each part's headers are handed to on_part, its data to on_data
+ * or straight to a file, and nothing is kept once it has been passed on.
+ * Delimiters are found with a Horspool search, and a tail that could be
+ * the start of one is held back until the next fragment decides it.
+ */
+
+/* longest boundary RFC 2046 allows */
+#define BHTTP_BOUNDARY_MAX      70
+/* CRLF "--" boundary */
+#define BHTTP_DELIM_MAX         (BHTTP_BOUNDARY_MAX + 4)
+/* larger part header blocks refuse the request */
+#define BHTTP_PART_HEAD_MAX     8192
+
+struct bhttp_request;
+
+typedef struct bhttp_part {
+    /* header block of the part, lines end with CRLF */
+    const char *headers;
+    size_t headers_len;
+    /* name and filename from content-disposition, and the content-type,
+     * "" when missing */
+    bstr name;
+    bstr filename;
+    bstr content_type;
+    /* parts before this one */
+    int index;
+    /* data bytes so far */
+    uint64_t size;
+    /* on_part can set this to have the data written there instead of
+     * passed to on_data, bittyhttp closes it once the part is complete */
+    int fd;
+} bhttp_part;
+
+typedef struct bhttp_multipart_opts {
+    /* once a part's headers are in, non-zero refuses the request with 400 */
+    int (*on_part)(struct bhttp_request *req, bhttp_part *part, void *arg);
+    /* data of the current part as it arrives, non-zero refuses with 400 */
+    int (*on_data)(struct bhttp_request *req, bhttp_part *part, const char *data, size_t len, void *arg);
+    /* after the last of a part's data, non-zero refuses with 400 */
+    int (*on_part_end)(struct bhttp_request *req, bhttp_part *part, void *arg);
+    /* larger parts refuse the request with 413, 0 for no limit */
+    uint64_t max_part_size;
+    void *arg;
+} bhttp_multipart_opts;
+
+typedef struct bhttp_multipart {
+    bhttp_multipart_opts opts;
+    int state;
+    bhttp_part part;
+    /* CRLF "--" boundary, and the Horspool shift for every byte */
+    char delim[BHTTP_DELIM_MAX];
+    size_t delim_len;
+    unsigned char shift[256];
+    /* end of the last fragment, it may be the start of a delimiter */
+    char hold[BHTTP_DELIM_MAX];
+    size_t hold_len;
+    /* header block of the current part */
+    char *head;
+    size_t head_len;
+    size_t head_cap;
+} bhttp_multipart;
+
+/* content_type is the request's header value
+ * returns 1 if it is not multipart or has no usable boundary */
+int bhttp_multipart_init(bhttp_multipart *mp, const char *content_type, size_t len,
+                         const bhttp_multipart_opts *opts);
+void bhttp_multipart_free(bhttp_multipart *mp);
+/* returns 0, or the response code to refuse the request with */
+int bhttp_multipart_feed(bhttp_multipart *mp, struct bhttp_request *req, const char *data, size_t len);
+/* 1 once the closing delimiter has been seen */
+int bhttp_multipart_complete(const bhttp_multipart *mp);
+
+#endif /* BITTYHTTP_MULTIPART_H */
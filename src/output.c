@@ -0,0 +1,604 @@
+/*
+ *  output.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "output.h"
+#include "arena.h"
+#include "server.h"
+
+/* only exposed with _XOPEN_SOURCE, 1024 is what linux allows */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* most handed to one sendfile call */
+#define SENDFILE_MAX (1 << 30)
+
+/* room in front of a stream piece for its chunk size line */
+#define STREAM_HEAD 8
+
+static void
+borrow_release(const bhttp_borrow *borrow)
+{
+    if (borrow->release != NULL)
+    {
+        /* user code, same as a handler */
+        int heap = bhttp_arena_heap_only(1);
+        borrow->release(borrow->arg);
+        bhttp_arena_heap_only(heap);
+    }
+}
+
+static void
+seg_free(bhttp_out_seg *seg)
+{
+    if (seg->type == BHTTP_OUT_STREAM && seg->stream.close != NULL)
+    {
+        int heap = bhttp_arena_heap_only(1);
+        seg->stream.close(seg->stream.arg);
+        bhttp_arena_heap_only(heap);
+    }
+    borrow_release(&seg->borrow);
+    bhttp_free(seg->buf);
+    bstr_free_contents(&seg->data);
+    bhttp_free(seg);
+}
+
+static bhttp_out_seg *
+seg_new(bhttp_out_seg_type type, const char *data, size_t len)
+{
+    bhttp_out_seg *seg = bhttp_malloc(sizeof(bhttp_out_seg));
+    if (seg == NULL) return NULL;
+    memset(seg, 0, sizeof(bhttp_out_seg));
+    seg->type = type;
+    bstr_init(&seg->data);
+    if (len > 0 && bstr_append_cstring(&seg->data, data, len) != BS_SUCCESS)
+    {
+        seg_free(seg);
+        return NULL;
+    }
+    if (type == BHTTP_OUT_BUF)
+    {
+        seg->bytes = bstr_cstring(&seg->data);
+        seg->size = (uint64_t)len;
+    }
+    return seg;
+}
+
+void
+bhttp_out_init(bhttp_out *out, int sock, int use_sendfile, int collect)
+{
+    out->sock = sock;
+    out->use_sendfile = use_sendfile;
+    out->collect = collect;
+    bvec_init(&out->segs, (void (*)(void *)) seg_free);
+    out->seg = 0;
+    out->seg_off = 0;
+    out->file = -1;
+}
+
+void
+bhttp_out_free(bhttp_out *out)
+{
+    bvec_free_contents(&out->segs);
+    if (out->file >= 0)
+        close(out->file);
+    out->file = -1;
+}
+
+void
+bhttp_out_reset(bhttp_out *out)
+{
+    bhttp_out_free(out);
+    bvec_init(&out->segs, (void (*)(void *)) seg_free);
+    out->seg = 0;
+    out->seg_off = 0;
+}
+
+static int
+send_buffer(int sock, const char *buf, size_t len)
+{
+    /* send buffer data */
+    ssize_t sent = send(sock, buf, len, MSG_NOSIGNAL);
+    if ( sent < 0 ) return 1;
+    if (sent < len) return 1;
+    return 0;
+}
+
+static int
+send_iov(int sock, struct iovec *iov, int count, int more)
+/* writes every byte of iov with as few syscalls as possible,
+ * more tells the kernel a file follows so it can share the segment */
+{
+    struct msghdr msg = {0};
+    while (count > 0)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)(count < IOV_MAX ? count : IOV_MAX);
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (sent < 0)
+        {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        /* skip what went out, a short write leaves us mid-buffer */
+        while (count > 0 && (size_t)sent >= iov->iov_len)
+        {
+            sent -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+static int
+send_file(int sock, const char *file_path, uint64_t offset, uint64_t size, int use_sendfile)
+/* makes sure to send size bytes of the file from offset to sock, a file
+ * that turns out shorter fails as the client was promised the bytes */
+{
+    int f = open(file_path, O_RDONLY);
+    if (f < 0)
+    {
+        fprintf(stderr, "Cannot open file %d\n", errno);
+        return 1;
+    }
+    off_t pos = (off_t)offset;
+    uint64_t left = size;
+    int bad = 0;
+    if (use_sendfile)
+    {
+        while (left > 0)
+        {
+            ssize_t ret = sendfile(sock, f, &pos, left < SENDFILE_MAX ? (size_t)left : SENDFILE_MAX);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+            {
+                if (ret < 0)
+                    perror("sendfile error");
+                bad = 1;
+                break;
+            }
+            left -= (uint64_t)ret;
+        }
+    }
+    else
+    {
+        char buf[SEND_BUFFER_SIZE];
+        while (left > 0)
+        {
+            ssize_t len = pread(f, buf, left < sizeof buf ? (size_t)left : sizeof buf, pos);
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len <= 0)
+            {
+                if (len < 0)
+                    perror("read error");
+                bad = 1;
+                break;
+            }
+            struct iovec iov = { buf, (size_t)len };
+            if (send_iov(sock, &iov, 1, left > (uint64_t)len))
+            {
+                perror("send error");
+                bad = 1;
+                break;
+            }
+            pos += len;
+            left -= (uint64_t)len;
+        }
+    }
+    close(f);
+    return bad;
+}
+
+int
+bhttp_out_buffer(bhttp_out *out, const char *buf, size_t len)
+{
+    if (!out->collect)
+        return send_buffer(out->sock, buf, len);
+    if (len == 0)
+        return 0;
+
+    bhttp_out_seg *seg = seg_new(BHTTP_OUT_BUF, buf, len);
+    if (seg == NULL) return 1;
+    bvec_add(&out->segs, seg);
+    return 0;
+}
+
+int
+bhttp_out_move(bhttp_out *out, bstr *data)
+{
+    size_t len = (size_t)bstr_size(data);
+    int r = 0;
+    if (!out->collect)
+        r = send_buffer(out->sock, bstr_cstring(data), len);
+    else if (len > 0)
+    {
+        bhttp_out_seg *seg = seg_new(BHTTP_OUT_BUF, NULL, 0);
+        if (seg == NULL)
+        {
+            bstr_free_contents(data);
+            bstr_init(data);
+            return 1;
+        }
+        seg->data = *data;
+        bstr_init(data);
+        seg->bytes = bstr_cstring(&seg->data);
+        seg->size = (uint64_t)len;
+        bvec_add(&out->segs, seg);
+        return 0;
+    }
+    bstr_free_contents(data);
+    bstr_init(data);
+    return r;
+}
+
+int
+bhttp_out_borrow(bhttp_out *out, const bhttp_borrow *borrow)
+{
+    if (!out->collect)
+    {
+        int r = send_buffer(out->sock, borrow->buf, borrow->len);
+        borrow_release(borrow);
+        return r;
+    }
+    bhttp_out_seg *seg = borrow->len > 0 ? seg_new(BHTTP_OUT_BUF, NULL, 0) : NULL;
+    if (seg == NULL)
+    {
+        borrow_release(borrow);
+        return borrow->len > 0;
+    }
+    seg->borrow = *borrow;
+    seg->bytes = borrow->buf;
+    seg->size = (uint64_t)borrow->len;
+    bvec_add(&out->segs, seg);
+    return 0;
+}
+
+int
+bhttp_out_file(bhttp_out *out, const char *file_path, uint64_t file_size)
+{
+    return bhttp_out_file_range(out, file_path, 0, file_size);
+}
+
+int
+bhttp_out_file_range(bhttp_out *out, const char *file_path, uint64_t offset, uint64_t size)
+{
+    if (!out->collect)
+        return send_file(out->sock, file_path, offset, size, out->use_sendfile);
+    if (size == 0)
+        return 0;
+
+    bhttp_out_seg *seg = seg_new(BHTTP_OUT_FILE, file_path, strlen(file_path));
+    if (seg == NULL) return 1;
+    seg->offset = offset;
+    seg->size = size;
+    bvec_add(&out->segs, seg);
+    return 0;
+}
+
+int
+bhttp_out_append(bhttp_out *out, bhttp_out *from)
+{
+    if (!out->collect)
+    {
+        from->sock = out->sock;
+        from->use_sendfile = out->use_sendfile;
+        return bhttp_out_flush(from);
+    }
+    int count = bvec_count(&from->segs);
+    for (int i = 0; i < count; i++)
+        bvec_add(&out->segs, bvec_get(&from->segs, i));
+    /* the segments belong to out now, only the list is freed */
+    from->segs.size = 0;
+    bhttp_out_reset(from);
+    return 0;
+}
+
+size_t
+bhttp_out_queued(bhttp_out *out)
+{
+    return (size_t)bvec_count(&out->segs);
+}
+
+int
+bhttp_out_stream_fill(bhttp_out_seg *seg)
+{
+    seg->buf_off = seg->buf_len = 0;
+    if (seg->ended)
+        return 0;
+    if (seg->buf == NULL &&
+        (seg->buf = bhttp_malloc(STREAM_HEAD + BHTTP_STREAM_CHUNK + 2)) == NULL)
+        return -1;
+
+    size_t room = seg->size < BHTTP_STREAM_CHUNK ? (size_t)seg->size : BHTTP_STREAM_CHUNK;
+    long n = 0;
+    if (room > 0)
+    {
+        /* the producer is user code, same as a handler */
+        int heap = bhttp_arena_heap_only(1);
+        n = seg->stream.read(seg->stream.arg, seg->buf + STREAM_HEAD, room);
+        bhttp_arena_heap_only(heap);
+    }
+    if (n < 0 || (size_t)n > room)
+        return -1;
+    if (n == 0)
+    {
+        seg->ended = 1;
+        /* the content-length promised more */
+        if (seg->size != BHTTP_STREAM_NO_LENGTH && seg->size > 0)
+            return -1;
+        if (!seg->chunked)
+            return 0;
+        memcpy(seg->buf, "0\r\n\r\n", 5);
+        seg->buf_len = 5;
+        return 1;
+    }
+
+    if (seg->size != BHTTP_STREAM_NO_LENGTH && (seg->size -= (uint64_t)n) == 0)
+        seg->ended = 1;
+    seg->buf_off = STREAM_HEAD;
+    seg->buf_len = (size_t)n;
+    if (seg->chunked)
+    {
+        char line[STREAM_HEAD + 1];
+        int len = snprintf(line, sizeof line, "%lx\r\n", n);
+        seg->buf_off -= (size_t)len;
+        memcpy(seg->buf + seg->buf_off, line, (size_t)len);
+        memcpy(seg->buf + STREAM_HEAD + n, "\r\n", 2);
+        seg->buf_len += (size_t)len + 2;
+    }
+    return 1;
+}
+
+static int
+send_stream(int sock, bhttp_out_seg *seg)
+/* each piece is made once the last one is in the socket, a slow client
+ * holds the producer back instead of piling up memory */
+{
+    int r;
+    while ((r = bhttp_out_stream_fill(seg)) > 0)
+    {
+        struct iovec iov = { seg->buf + seg->buf_off, seg->buf_len };
+        if (send_iov(sock, &iov, 1, 0) != 0)
+            return 1;
+    }
+    return r < 0;
+}
+
+int
+bhttp_out_stream(bhttp_out *out, const bhttp_stream *stream, uint64_t length, int chunked)
+{
+    bhttp_out_seg *seg = seg_new(BHTTP_OUT_STREAM, NULL, 0);
+    if (seg == NULL)
+    {
+        if (stream->close != NULL)
+            stream->close(stream->arg);
+        return 1;
+    }
+    seg->stream = *stream;
+    seg->size = length;
+    seg->chunked = chunked && length == BHTTP_STREAM_NO_LENGTH;
+    if (!out->collect)
+    {
+        int r = send_stream(out->sock, seg);
+        seg_free(seg);
+        return r;
+    }
+    bvec_add(&out->segs, seg);
+    return 0;
+}
+
+int
+bhttp_out_flush(bhttp_out *out)
+{
+    int count = bvec_count(&out->segs);
+    struct iovec *iov = NULL;
+    if (count > 0 && (iov = bhttp_malloc(sizeof(struct iovec) * (size_t)count)) == NULL)
+    {
+        bhttp_out_reset(out);
+        return 1;
+    }
+
+    int bad = 0;
+    int i = 0;
+    while (i < count && !bad)
+    {
+        /* gather every buffer up to the next file into one write */
+        int n = 0;
+        for (; i < count; i++)
+        {
+            bhttp_out_seg *seg = bvec_get(&out->segs, i);
+            if (seg->type != BHTTP_OUT_BUF)
+                break;
+            iov[n].iov_base = (void *)seg->bytes;
+            iov[n].iov_len = (size_t)seg->size;
+            n++;
+        }
+        if (n > 0)
+            bad = send_iov(out->sock, iov, n, i < count);
+        if (i < count && !bad)
+        {
+            bhttp_out_seg *seg = bvec_get(&out->segs, i);
+            if (seg->type == BHTTP_OUT_STREAM)
+                bad = send_stream(out->sock, seg);
+            else
+                bad = send_file(out->sock, bstr_cstring(&seg->data), seg->offset, seg->size, out->use_sendfile);
+            i++;
+        }
+    }
+    bhttp_free(iov);
+    bhttp_out_reset(out);
+    return bad;
+}
+
+static int
+send_failed(void)
+/* after a send that returned -1, BHTTP_OUT_AGAIN if the socket was only
+ * full, 0 to try again straight away, 1 for an error */
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return BHTTP_OUT_AGAIN;
+    return errno == EINTR ? 0 : 1;
+}
+
+static void
+advance_bufs(bhttp_out *out, uint64_t n)
+/* moves the cursor past n bytes of consecutive buffers */
+{
+    while (n > 0)
+    {
+        bhttp_out_seg *seg = bvec_get(&out->segs, out->seg);
+        uint64_t step = seg->size - out->seg_off < n ? seg->size - out->seg_off : n;
+        out->seg_off += step;
+        n -= step;
+        if (out->seg_off == seg->size)
+        {
+            out->seg++;
+            out->seg_off = 0;
+        }
+    }
+}
+
+static ssize_t
+send_bufs(bhttp_out *out, int count)
+/* one sendmsg for the buffers from the cursor up to the next file or stream */
+{
+    struct iovec iov[64];
+    int n = 0;
+    int i = out->seg;
+    for (; i < count && n < (int)(sizeof iov / sizeof iov[0]); i++)
+    {
+        bhttp_out_seg *seg = bvec_get(&out->segs, i);
+        if (seg->type != BHTTP_OUT_BUF)
+            break;
+        uint64_t off = i == out->seg ? out->seg_off : 0;
+        iov[n].iov_base = (char *)seg->bytes + off;
+        iov[n].iov_len = (size_t)(seg->size - off);
+        n++;
+    }
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)n;
+    return sendmsg(out->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (i < count ? MSG_MORE : 0));
+}
+
+static ssize_t
+send_file_part(bhttp_out *out, bhttp_out_seg *seg, int more)
+/* sends what the socket takes of the file segment at the cursor, 0 if the
+ * file ended early */
+{
+    if (out->file < 0 && (out->file = open(bstr_cstring(&seg->data), O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "Cannot open file %d\n", errno);
+        errno = EIO;
+        return -1;
+    }
+    uint64_t left = seg->size - out->seg_off;
+    off_t pos = (off_t)(seg->offset + out->seg_off);
+    if (out->use_sendfile)
+        return sendfile(out->sock, out->file, &pos, left < SENDFILE_MAX ? (size_t)left : SENDFILE_MAX);
+
+    /* what the socket does not take is read again next time */
+    char buf[SEND_BUFFER_SIZE];
+    ssize_t len = pread(out->file, buf, left < sizeof buf ? (size_t)left : sizeof buf, pos);
+    if (len <= 0)
+    {
+        if (len < 0 && errno != EINTR)
+            errno = EIO;
+        return len;
+    }
+    return send(out->sock, buf, (size_t)len,
+                MSG_NOSIGNAL | MSG_DONTWAIT | (more || left > (uint64_t)len ? MSG_MORE : 0));
+}
+
+int
+bhttp_out_send(bhttp_out *out)
+{
+    int count = bvec_count(&out->segs);
+    while (out->seg < count)
+    {
+        bhttp_out_seg *seg = bvec_get(&out->segs, out->seg);
+        ssize_t sent;
+        if (seg->type == BHTTP_OUT_BUF)
+        {
+            if ((sent = send_bufs(out, count)) < 0)
+            {
+                int r = send_failed();
+                if (r != 0) return r;
+                continue;
+            }
+            advance_bufs(out, (uint64_t)sent);
+        }
+        else if (seg->type == BHTTP_OUT_FILE)
+        {
+            if ((sent = send_file_part(out, seg, out->seg + 1 < count)) < 0)
+            {
+                int r = send_failed();
+                if (r != 0) return r;
+                continue;
+            }
+            /* the client was promised the bytes */
+            if (sent == 0)
+                return 1;
+            if ((out->seg_off += (uint64_t)sent) == seg->size)
+            {
+                close(out->file);
+                out->file = -1;
+                out->seg++;
+                out->seg_off = 0;
+            }
+        }
+        else
+        {
+            /* the last piece is out, ask for the next */
+            if (out->seg_off >= seg->buf_len)
+            {
+                int r = seg->ended ? 0 : bhttp_out_stream_fill(seg);
+                out->seg_off = 0;
+                if (r < 0)
+                    return 1;
+                if (r == 0)
+                {
+                    out->seg++;
+                    continue;
+                }
+            }
+            /* stays on the stream until its last piece is sent */
+            sent = send(out->sock, seg->buf + seg->buf_off + out->seg_off,
+                        seg->buf_len - (size_t)out->seg_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                int r = send_failed();
+                if (r != 0) return r;
+                continue;
+            }
+            out->seg_off += (uint64_t)sent;
+        }
+    }
+    bhttp_out_reset(out);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ *  output.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_OUTPUT_H
+#define BITTYHTTP_OUTPUT_H
+
+#include <stdint.h>
+#include "bittystring.h"
+#include "bittyvec.h"
+
+/*
+ * Everything written to a connection goes through a bhttp_out. It either
+ * writes straight to the socket, or, with collect set, queues the segments
+ * so an event loop can send them itself, all at once with bhttp_out_flush
+ * or as the socket has room with bhttp_out_send.
+ */
+typedef enum {
+    BHTTP_OUT_BUF = 0,
+    BHTTP_OUT_FILE,
+    BHTTP_OUT_STREAM
+} bhttp_out_seg_type;
+
+/* a body pulled from its producer a piece at a time while it is sent, the
+ * next piece is only asked for once the last one is out */
+typedef struct bhttp_stream {
+    /* fills buf with up to len bytes of the body and returns how many, 0
+     * once it is complete, -1 to cut it short and close the connection */
+    long (*read)(void *arg, char *buf, size_t len);
+    /* called once the body is sent or given up on, may be NULL */
+    void (*close)(void *arg);
+    void *arg;
+} bhttp_stream;
+
+/* bytes sent without being copied. release is called with arg once they
+ * are sent or given up on, it may be NULL for memory that is never freed */
+typedef struct bhttp_borrow {
+    const char *buf;
+    size_t len;
+    void (*release)(void *arg);
+    void *arg;
+} bhttp_borrow;
+
+/* length of a stream that is not known up front */
+#define BHTTP_STREAM_NO_LENGTH  UINT64_MAX
+/* most asked of a stream at a time */
+#define BHTTP_STREAM_CHUNK      16384
+/* room for a typical response header block, built on the stack */
+#define BHTTP_OUT_HEAD          512
+
+typedef struct bhttp_out_seg {
+    bhttp_out_seg_type type;
+    /* bytes the seg owns, or the path of the file */
+    bstr data;
+    /* bytes to send, in data or borrowed */
+    const char *bytes;
+    bhttp_borrow borrow;
+    /* bytes to send, of the file from offset, or left of a stream */
+    uint64_t offset;
+    uint64_t size;
+    /* streams, the piece being sent is buf_len bytes at buf + buf_off */
+    bhttp_stream stream;
+    int chunked;
+    int ended;
+    char *buf;
+    size_t buf_off;
+    size_t buf_len;
+} bhttp_out_seg;
+
+typedef struct bhttp_out {
+    int sock;
+    int use_sendfile;
+    int collect;
+    /* queued bhttp_out_seg when collecting */
+    bvec segs;
+    /* how far bhttp_out_send got, and the file of that segment, -1 if none */
+    int seg;
+    uint64_t seg_off;
+    int file;
+} bhttp_out;
+
+void bhttp_out_init(bhttp_out *out, int sock, int use_sendfile, int collect);
+void bhttp_out_free(bhttp_out *out);
+/* drops everything queued so far */
+void bhttp_out_reset(bhttp_out *out);
+/* number of segments waiting to be sent */
+size_t bhttp_out_queued(bhttp_out *out);
+/* writes everything queued to a blocking socket and resets the queue,
+ * returns 0 on success, 1 on failure */
+int bhttp_out_flush(bhttp_out *out);
+/* bhttp_out_send found the socket full */
+#define BHTTP_OUT_AGAIN 2
+/* writes what a non-blocking socket takes and remembers where it stopped,
+ * the queue is reset once all of it is sent. returns 0 then, 1 on failure
+ * and BHTTP_OUT_AGAIN to be called again once the socket is writable */
+int bhttp_out_send(bhttp_out *out);
+
+/* all return 0 on success, 1 on failure */
+int bhttp_out_buffer(bhttp_out *out, const char *buf, size_t len);
+/* sends the contents of data without copying them, data is left empty
+ * even on failure */
+int bhttp_out_move(bhttp_out *out, bstr *data);
+/* out takes over the borrowed bytes, they are released even on failure */
+int bhttp_out_borrow(bhttp_out *out, const bhttp_borrow *borrow);
+int bhttp_out_file(bhttp_out *out, const char *file_path, uint64_t file_size);
+int bhttp_out_file_range(bhttp_out *out, const char *file_path, uint64_t offset, uint64_t size);
+/* queues everything from has queued after what out has, or sends it if
+ * out is not collecting. from is left empty */
+int bhttp_out_append(bhttp_out *out, bhttp_out *from);
+/* out takes over the stream, which has to supply exactly length bytes. with
+ * BHTTP_STREAM_NO_LENGTH it is sent until it ends, framed as chunks if
+ * chunked is set */
+int bhttp_out_stream(bhttp_out *out, const bhttp_stream *stream, uint64_t length, int chunked);
+/* puts the next piece of a stream seg in its buf, returns 1 if there is
+ * one, 0 once the stream has ended and -1 if it failed */
+int bhttp_out_stream_fill(bhttp_out_seg *seg);
+
+#endif /* BITTYHTTP_OUTPUT_H */
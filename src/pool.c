@@ -0,0 +1,275 @@
+/*
+ *  pool.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "pool.h"
+#include "server.h"
+
+#define CACHE_LINE 64
+
+/*
+ * Bounded MPMC queue after Dmitry Vyukov's design: every cell carries a
+ * sequence number which tells producers and consumers whether it is free for
+ * them, so the hand-off itself never takes a lock. The two semaphores only
+ * count free slots and queued items so idle workers and a blocked acceptor
+ * can sleep instead of spinning.
+ */
+typedef struct
+{
+    size_t seq;
+    bhttp_pool_job job;
+} pool_cell;
+
+struct bhttp_pool
+{
+    bhttp_server *server;
+    int nworkers;
+    pthread_t *workers;
+    pool_cell *cells;
+    size_t mask;
+
+    char pad0[CACHE_LINE];
+    size_t enqueue_pos;
+    char pad1[CACHE_LINE];
+    size_t dequeue_pos;
+    char pad2[CACHE_LINE];
+
+    sem_t items;
+    sem_t slots;
+    int shutdown;
+
+    /* stats, updated atomically */
+    uint64_t queued;
+    uint64_t rejected;
+    uint64_t wait_ns_total;
+    uint64_t wait_ns_max;
+};
+
+static int
+queue_push(bhttp_pool *p, const bhttp_pool_job *job)
+/* returns 0 on success, 1 if the queue is full */
+{
+    pool_cell *cell;
+    size_t pos = __atomic_load_n(&p->enqueue_pos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        cell = &p->cells[pos & p->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&p->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0)
+            return 1;
+        else
+            pos = __atomic_load_n(&p->enqueue_pos, __ATOMIC_RELAXED);
+    }
+    cell->job = *job;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int
+queue_pop(bhttp_pool *p, bhttp_pool_job *job)
+/* returns 0 on success, 1 if the queue is empty */
+{
+    pool_cell *cell;
+    size_t pos = __atomic_load_n(&p->dequeue_pos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        cell = &p->cells[pos & p->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&p->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0)
+            return 1;
+        else
+            pos = __atomic_load_n(&p->dequeue_pos, __ATOMIC_RELAXED);
+    }
+    *job = cell->job;
+    __atomic_store_n(&cell->seq, pos + p->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static uint64_t
+elapsed_ns(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ns = (int64_t)(now.tv_sec - since->tv_sec) * 1000000000 +
+                 (now.tv_nsec - since->tv_nsec);
+    return ns > 0 ? (uint64_t)ns : 0;
+}
+
+static void
+record_wait(bhttp_pool *p, uint64_t ns)
+{
+    __atomic_add_fetch(&p->wait_ns_total, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&p->wait_ns_max, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&p->wait_ns_max, &max, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void *
+worker(void *arg)
+{
+    bhttp_pool *p = arg;
+    bhttp_pool_job job;
+
+    while (1)
+    {
+        if (sem_wait(&p->items) != 0)
+            continue;
+        if (__atomic_load_n(&p->shutdown, __ATOMIC_ACQUIRE))
+            break;
+        /* holding an item means one is queued, though a producer may still
+         * be publishing the cell in front of it */
+        while (queue_pop(p, &job) != 0);
+        sem_post(&p->slots);
+
+        record_wait(p, elapsed_ns(&job.queued));
+        bhttp_server_serve_connection(p->server, job.sock, job.ipstr);
+    }
+    return NULL;
+}
+
+bhttp_pool *
+bhttp_pool_new(bhttp_server *server, int workers, int queue_depth, int cpu)
+{
+    if (workers <= 0 || queue_depth <= 0)
+        return NULL;
+
+    bhttp_pool *p = calloc(1, sizeof(bhttp_pool));
+    if (p == NULL)
+        return NULL;
+    p->server = server;
+
+    /* round the queue up to a power of two so positions can be masked */
+    size_t capacity = 2;
+    while (capacity < (size_t)queue_depth)
+        capacity <<= 1;
+    p->mask = capacity - 1;
+    p->cells = malloc(capacity * sizeof(pool_cell));
+    p->workers = malloc((size_t)workers * sizeof(pthread_t));
+    if (p->cells == NULL || p->workers == NULL)
+        goto bad;
+    for (size_t i = 0; i < capacity; i++)
+        p->cells[i].seq = i;
+
+    if (sem_init(&p->items, 0, 0) != 0)
+        goto bad;
+    if (sem_init(&p->slots, 0, (unsigned int)capacity) != 0)
+    {
+        sem_destroy(&p->items);
+        goto bad;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof set, &set);
+    }
+    for (p->nworkers = 0; p->nworkers < workers; p->nworkers++)
+    {
+        if (pthread_create(&p->workers[p->nworkers], &attr, worker, p) != 0)
+        {
+            fprintf(stderr, "Could not create pool worker thread\n");
+            pthread_attr_destroy(&attr);
+            bhttp_pool_free(p);
+            return NULL;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return p;
+
+bad:
+    free(p->cells);
+    free(p->workers);
+    free(p);
+    return NULL;
+}
+
+void
+bhttp_pool_free(bhttp_pool *p)
+{
+    __atomic_store_n(&p->shutdown, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < p->nworkers; i++)
+        sem_post(&p->items);
+    for (int i = 0; i < p->nworkers; i++)
+        pthread_join(p->workers[i], NULL);
+
+    /* nobody is going to serve what is left in the queue */
+    bhttp_pool_job job;
+    while (queue_pop(p, &job) == 0)
+        close(job.sock);
+
+    sem_destroy(&p->items);
+    sem_destroy(&p->slots);
+    free(p->cells);
+    free(p->workers);
+    free(p);
+}
+
+int
+bhttp_pool_push(bhttp_pool *p, bhttp_pool_job *job, int block)
+{
+    if (block)
+    {
+        while (sem_wait(&p->slots) != 0)
+            if (errno != EINTR) return 1;
+    }
+    else if (sem_trywait(&p->slots) != 0)
+    {
+        __atomic_add_fetch(&p->rejected, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->queued);
+    /* holding a slot means there is a free cell */
+    while (queue_push(p, job) != 0);
+    __atomic_add_fetch(&p->queued, 1, __ATOMIC_RELAXED);
+    sem_post(&p->items);
+    return 0;
+}
+
+void
+bhttp_pool_get_stats(bhttp_pool *p, bhttp_pool_stats *stats)
+{
+    size_t enq = __atomic_load_n(&p->enqueue_pos, __ATOMIC_RELAXED);
+    size_t deq = __atomic_load_n(&p->dequeue_pos, __ATOMIC_RELAXED);
+
+    stats->workers = p->nworkers;
+    stats->queue_capacity = (int)(p->mask + 1);
+    stats->queue_depth = enq > deq ? (int)(enq - deq) : 0;
+    stats->queued = __atomic_load_n(&p->queued, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&p->rejected, __ATOMIC_RELAXED);
+    stats->wait_ns_total = __atomic_load_n(&p->wait_ns_total, __ATOMIC_RELAXED);
+    stats->wait_ns_max = __atomic_load_n(&p->wait_ns_max, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,53 @@
+/*
+ *  pool.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_POOL_H
+#define BITTYHTTP_POOL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct bhttp_server;
+
+/* what the acceptor does with a connection when the queue is full */
+typedef enum {
+    BHTTP_POOL_BLOCK = 0,   /* wait for a worker to free a slot */
+    BHTTP_POOL_SHED,        /* reply 503 and close */
+    BHTTP_POOL_CLOSE        /* close without replying */
+} bhttp_pool_policy;
+
+typedef struct bhttp_pool_stats {
+    int workers;
+    int queue_capacity;
+    int queue_depth;            /* connections waiting for a worker right now */
+    uint64_t queued;            /* connections handed to the pool */
+    uint64_t rejected;          /* connections dropped because the queue was full */
+    uint64_t wait_ns_total;     /* time spent in the queue, summed over all connections */
+    uint64_t wait_ns_max;
+} bhttp_pool_stats;
+
+/* an accepted connection waiting in the queue, stored by value */
+typedef struct bhttp_pool_job {
+    int sock;
+    char ipstr[INET6_ADDRSTRLEN];
+    struct timespec queued;
+} bhttp_pool_job;
+
+typedef struct bhttp_pool bhttp_pool;
+
+/* cpu pins every worker to that cpu, -1 leaves them unpinned */
+bhttp_pool * bhttp_pool_new(struct bhttp_server *server, int workers, int queue_depth, int cpu);
+/* lets running connections finish, then stops every worker and closes queued sockets */
+void bhttp_pool_free(bhttp_pool *pool);
+/* returns 0 once the job is queued, 1 if the queue is full and block is 0 */
+int bhttp_pool_push(bhttp_pool *pool, bhttp_pool_job *job, int block);
+void bhttp_pool_get_stats(bhttp_pool *pool, bhttp_pool_stats *stats);
+
+#endif /* BITTYHTTP_POOL_H */
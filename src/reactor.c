@@ -0,0 +1,373 @@
+/*
+ *  reactor.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "reactor.h"
+#include "server.h"
+
+#define REACTOR_MAX_EVENTS  64
+#define REACTOR_READ_SIZE   4096
+/* arena blocks kept for connections that go idle and come back */
+#define REACTOR_ARENA_SPARES 64
+
+/*
+ * Each connection only keeps its parser state and unparsed bytes between
+ * readable events, handlers are run on the reactor thread once a request
+ * is complete. Responses to pipelined requests are collected and sent
+ * together, as far as the socket takes them. What is left waits on the
+ * connection for it to become writable, and nothing more is read from it
+ * until then, so a client that does not read only holds up itself. The
+ * idle timer keeps running while it waits.
+ */
+typedef struct bhttp_conn
+{
+    int sock;
+    char ipstr[INET6_ADDRSTRLEN];
+    bhttp_request req;
+    /* bytes not parsed yet, may hold pipelined requests */
+    bhttp_readbuf rb;
+    /* requests and responses allocate from here, see arena.h */
+    bhttp_arena arena;
+    /* responses not yet taken by the socket */
+    bhttp_out out;
+    /* close once out is sent */
+    int closing;
+    /* a refused request may have left its body unread */
+    int drain;
+    /* last time data arrived, idle connections are closed after TIMEOUT_SECONDS */
+    time_t last_active;
+    /* open connections, most recently active first */
+    struct bhttp_conn *prev;
+    struct bhttp_conn *next;
+} bhttp_conn;
+
+typedef struct
+{
+    bhttp_server *server;
+    bhttp_shard *shard;
+    int epfd;
+    bhttp_conn *head;
+    bhttp_conn *tail;
+    bhttp_arena_spares spares;
+} reactor;
+
+static int
+set_nonblocking(int sock, int on)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) return 1;
+    flags = on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    if (fcntl(sock, F_SETFL, flags) == -1) return 1;
+    return 0;
+}
+
+static void
+conn_unlink(reactor *r, bhttp_conn *c)
+{
+    if (c->prev) c->prev->next = c->next;
+    else r->head = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else r->tail = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void
+conn_push(reactor *r, bhttp_conn *c)
+{
+    c->prev = NULL;
+    c->next = r->head;
+    if (r->head) r->head->prev = c;
+    r->head = c;
+    if (r->tail == NULL) r->tail = c;
+}
+
+static void
+conn_touch(reactor *r, bhttp_conn *c, time_t now)
+/* moves c to the front of the idle list */
+{
+    c->last_active = now;
+    if (r->head == c) return;
+    conn_unlink(r, c);
+    conn_push(r, c);
+}
+
+static void
+conn_close(reactor *r, bhttp_conn *c)
+{
+    conn_unlink(r, c);
+    /* closing the socket also removes it from the epoll set */
+    bhttp_server_close_conn(c->sock, c->drain);
+    bhttp_arena *prev = bhttp_arena_use(&c->arena);
+    bhttp_request_free(&c->req);
+    bhttp_out_free(&c->out);
+    bhttp_arena_free(&c->arena);
+    bhttp_arena_use(prev);
+    bhttp_readbuf_free(&c->rb);
+    free(c);
+}
+
+static void
+accept_all(reactor *r, time_t now)
+/* accepts every pending connection on the (edge-triggered) listening socket */
+{
+    struct sockaddr_storage their_addr;
+    socklen_t sin_size;
+
+    while (1)
+    {
+        sin_size = sizeof their_addr;
+        int con = accept(r->shard->sock, (struct sockaddr *)&their_addr, &sin_size);
+        if (con == -1)
+        {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+        __atomic_add_fetch(&r->shard->accepts, 1, __ATOMIC_RELAXED);
+
+        bhttp_conn *c = malloc(sizeof(bhttp_conn));
+        if (c == NULL)
+        {
+            fprintf(stderr, "Could not allocate data for connection\n");
+            close(con);
+            continue;
+        }
+        c->sock = con;
+        c->closing = 0;
+        c->drain = 0;
+        if (fill_ip(&their_addr, c->ipstr, sizeof c->ipstr) != 0 ||
+            set_nonblocking(con, 1) != 0)
+        {
+            fprintf(stderr, "Could not set up connection\n");
+            close(con);
+            free(c);
+            continue;
+        }
+        bhttp_request_init(&c->req);
+        c->req.ip = c->ipstr;
+        c->req.server = r->server;
+        bhttp_readbuf_init(&c->rb);
+        bhttp_arena_init(&c->arena, r->server->arena_size, &r->spares);
+        bhttp_out_init(&c->out, con, r->server->use_sendfile, 1);
+
+        /* writable events only come after a send found the socket full */
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, con, &ev) == -1)
+        {
+            perror("epoll_ctl");
+            close(con);
+            bhttp_request_free(&c->req);
+            free(c);
+            continue;
+        }
+        c->last_active = now;
+        conn_push(r, c);
+    }
+}
+
+static int
+conn_send(reactor *r, bhttp_conn *c)
+/* sends what the socket takes of the queued responses
+ * returns 0 to keep the connection open, 1 to close it */
+{
+    if (bhttp_out_queued(&c->out) > 0)
+    {
+        int ret = bhttp_out_send(&c->out);
+        if (ret == BHTTP_OUT_AGAIN)
+            return 0;
+        if (ret != 0)
+            return 1;
+    }
+    if (c->closing)
+        return 1;
+    /* everything answered is sent, start the arena over */
+    if (!bhttp_request_started(&c->req))
+        bhttp_arena_reset(&c->arena);
+    return 0;
+}
+
+static int
+conn_answer(reactor *r, bhttp_conn *c)
+/* answers every complete request in the read buffer, then sends them
+ * returns 0 to keep the connection open, 1 to close it */
+{
+    while (!c->closing)
+    {
+        if (bhttp_request_feed(&c->req, &c->rb) != BHTTP_REQ_OK)
+        {
+            c->closing = 1;
+            break;
+        }
+        if (!c->req.done)
+        {
+            /* goes out after the responses before it */
+            bhttp_request_continue(&c->req, &c->out);
+            break;
+        }
+
+        bhttp_server_respond(r->server, &c->req, &c->out);
+        /* the response can still close the connection */
+        c->closing = c->req.keep_alive != BHTTP_KEEP_ALIVE;
+        c->drain = c->req.reject != 0;
+        bhttp_request_free(&c->req);
+        bhttp_request_init(&c->req);
+        c->req.ip = c->ipstr;
+        c->req.server = r->server;
+    }
+    return conn_send(r, c);
+}
+
+static int
+conn_drain(reactor *r, bhttp_conn *c)
+/* drains the socket and answers every completed request
+ * returns 0 to keep the connection open, 1 to close it */
+{
+    ssize_t n;
+
+    /* the rest of the responses go out first */
+    if (conn_send(r, c) != 0)
+        return 1;
+    while (1)
+    {
+        if (bhttp_out_queued(&c->out) > 0)
+            return 0;
+        if (bhttp_request_splice_left(&c->req) > 0)
+        {
+            /* uploads go from the socket to their file without the buffer */
+            if (bhttp_request_splice(&c->req, c->sock) != BHTTP_REQ_OK)
+                return 1;
+            if (!c->req.done && bhttp_request_splice_left(&c->req) > 0)
+                return 0;
+            if (c->req.done && conn_answer(r, c) != 0)
+                return 1;
+            continue;
+        }
+
+        char *buf = bhttp_readbuf_reserve(&c->rb, REACTOR_READ_SIZE);
+        if (buf == NULL)
+            return 1;
+        n = recv(c->sock, buf, c->rb.capacity - c->rb.size, 0);
+        if (n == 0)
+            return 1;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* idle keep-alive connections should not hold a buffer */
+                bhttp_readbuf_shrink(&c->rb);
+                if (!bhttp_request_started(&c->req))
+                    bhttp_arena_free(&c->arena);
+                return 0;
+            }
+            return 1;
+        }
+        c->rb.size += (size_t)n;
+
+        if (conn_answer(r, c) != 0)
+            return 1;
+    }
+}
+
+static int
+conn_read(reactor *r, bhttp_conn *c)
+/* conn_drain with the connection's arena in use */
+{
+    bhttp_arena *prev = bhttp_arena_use(&c->arena);
+    int ret = conn_drain(r, c);
+    bhttp_arena_use(prev);
+    return ret;
+}
+
+static void
+expire_idle(reactor *r, time_t now)
+/* closes connections which have not sent anything for TIMEOUT_SECONDS */
+{
+    while (r->tail != NULL && now - r->tail->last_active >= TIMEOUT_SECONDS)
+        conn_close(r, r->tail);
+}
+
+static void
+reactor_cleanup(void *arg)
+{
+    reactor *r = arg;
+    while (r->head != NULL)
+        conn_close(r, r->head);
+    bhttp_arena_spares_free(&r->spares);
+    close(r->epfd);
+}
+
+void
+bhttp_reactor_run(bhttp_shard *shard)
+{
+    reactor r = {0};
+    r.server = shard->server;
+    r.shard = shard;
+    bhttp_arena_spares_init(&r.spares, REACTOR_ARENA_SPARES);
+    r.epfd = epoll_create1(0);
+    if (r.epfd == -1)
+    {
+        perror("epoll_create1");
+        return;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (set_nonblocking(shard->sock, 1) != 0 ||
+        epoll_ctl(r.epfd, EPOLL_CTL_ADD, shard->sock, &ev) == -1)
+    {
+        perror("could not watch listening socket");
+        close(r.epfd);
+        return;
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    pthread_cleanup_push(reactor_cleanup, &r);
+    while (1)
+    {
+        /* wake up at least once a second to close idle connections */
+        int n = epoll_wait(r.epfd, events, REACTOR_MAX_EVENTS, 1000);
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        /* bhttp_server_stop, open connections are closed on the way out */
+        if (__atomic_load_n(&r.server->stopping, __ATOMIC_ACQUIRE))
+            break;
+
+        time_t now = time(NULL);
+        for (int i = 0; i < n; i++)
+        {
+            bhttp_conn *c = events[i].data.ptr;
+            /* listening socket */
+            if (c == NULL)
+            {
+                accept_all(&r, now);
+                continue;
+            }
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) || conn_read(&r, c) != 0)
+                conn_close(&r, c);
+            else
+                conn_touch(&r, c, now);
+        }
+        expire_idle(&r, now);
+    }
+    pthread_cleanup_pop(1);
+}
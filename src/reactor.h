@@ -0,0 +1,18 @@
+/*
+ *  reactor.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_REACTOR_H
+#define BITTYHTTP_REACTOR_H
+
+struct bhttp_shard;
+
+/* serves every connection of one listener from the calling thread using
+ * edge-triggered epoll, only returns on error or when the server is stopped */
+void bhttp_reactor_run(struct bhttp_shard *shard);
+
+#endif /* BITTYHTTP_REACTOR_H */
@@ -6,36 +6,36 @@
  *  Copyright (c) 2021 Colin Luoma. All rights reserved.
  */
 
+/* for splice */
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include "request.h"
 #include "server.h"
+#include "arena.h"
+#include "urldecode.h"
+#ifdef FASTPARSE
+#include "fastparse.h"
+#endif
 
 #define REQUEST_BUF_SIZE 1024
+/* urls up to this long are decoded without an allocation */
+#define URL_DECODE_STACK 1024
+/* pipe size asked for when splicing uploads, and the most moved at a time */
+#define SPLICE_PIPE_SIZE (1 << 20)
 
-static const char unhex_tbl[256] = {
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        0, 1, 2, 3, 4, 5, 6, 7,  8, 9,-1,-1,-1,-1,-1,-1,
-        -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1
-};
+#define FAST_FALLBACK   -1
+#define FAST_MAX_HEADERS 64
 
 /*
  * Request parsing callback functions
@@ -48,6 +48,22 @@ int header_value_cb(http_parser* parser, const char *at, size_t length);
 int header_end_cb(http_parser* parser);
 int body_cb(http_parser* parser, const char *at, size_t length);
 int message_end_cb(http_parser* parser);
+#ifdef FASTPARSE
+static int fast_feed(bhttp_request *request, bhttp_readbuf *rb);
+#endif
+static uint64_t now_ms(void);
+static void read_limits(bhttp_request *req, bhttp_readbuf *rb);
+
+/* callbacks, the same for every request */
+static const http_parser_settings parser_settings = {
+    .on_message_begin    = start_cb,
+    .on_url              = url_cb,
+    .on_header_field     = header_field_cb,
+    .on_header_value     = header_value_cb,
+    .on_headers_complete = header_end_cb,
+    .on_body             = body_cb,
+    .on_message_complete = message_end_cb
+};
 
 static void
 init_parser(bhttp_request *request)
@@ -56,26 +72,61 @@ init_parser(bhttp_request *request)
     http_parser_init(&request->parser, HTTP_REQUEST);
     /* url parser */
     http_parser_url_init(&request->parser_url);
-    /* callbacks */
-    http_parser_settings_init(&request->settings);
-    request->settings.on_message_begin    = start_cb;
-    request->settings.on_url              = url_cb;
-    request->settings.on_header_field     = header_field_cb;
-    request->settings.on_header_value     = header_value_cb;
-    request->settings.on_headers_complete = header_end_cb;
-    request->settings.on_body             = body_cb;
-    request->settings.on_message_complete = message_end_cb;
 }
 
 void
 bhttp_request_init(bhttp_request *request)
 {
     request->keep_alive = BHTTP_CLOSE;
+    request->http_minor = 1;
     bstr_init(&request->uri);
     bstr_init(&request->uri_path);
     bstr_init(&request->uri_query);
-    bvec_init(&request->headers, (void (*)(void *)) &bhttp_header_free);
-    request->cookie = bhttp_cookie_new();
+    request->rb = NULL;
+    request->headers = NULL;
+    request->header_count = 0;
+    request->header_capacity = 0;
+    memset(request->known, 0, sizeof request->known);
+    request->start_ms = 0;
+    request->head_ms = 0;
+    request->head_end = 0;
+    request->head_done = 0;
+    request->folded = 0;
+#ifdef FASTPARSE
+    request->engine = BHTTP_ENGINE_FAST_HEAD;
+#else
+    request->engine = BHTTP_ENGINE_HTTP_PARSER;
+#endif
+    request->body_left = 0;
+    memset(&request->body_opts, 0, sizeof request->body_opts);
+    request->body_size = 0;
+    request->body_expect = 0;
+    request->splice_pipe[0] = request->splice_pipe[1] = -1;
+    request->no_splice = 0;
+    request->multipart = NULL;
+    request->body_fd = -1;
+    request->reject = 0;
+    request->expect_continue = 0;
+    request->user_data = NULL;
+    request->server = NULL;
+    request->handler = NULL;
+    request->route_args = NULL;
+    request->route = 0;
+    /* made on first use, a new request allocates nothing until it is parsed */
+    request->cookie = NULL;
+    request->cookies = NULL;
+    request->cookie_count = 0;
+    request->cookie_capacity = 0;
+    request->cookies_parsed = 0;
+    request->cookie_slots = NULL;
+    request->params = NULL;
+    request->param_count = 0;
+    request->param_capacity = 0;
+    request->param_names_count = 0;
+    request->params_parsed = 0;
+    request->param_slots = NULL;
+    request->param_names = NULL;
+    request->param_names_used = 0;
     bstr_init(&request->body);
     request->done = 0;
     init_parser(request);
@@ -88,20 +139,45 @@ bhttp_request_free(bhttp_request *request)
     bstr_free_contents(&request->uri);
     bstr_free_contents(&request->uri_path);
     bstr_free_contents(&request->uri_query);
-    bvec_free_contents(&request->headers);
-    bhttp_cookie_free(request->cookie);
+    for (int i = 0; i < request->header_count; i++)
+    {
+        if (request->headers[i].h != NULL)
+            bhttp_header_free(request->headers[i].h);
+    }
+    bhttp_free(request->headers);
+    if (request->cookie != NULL)
+        bhttp_cookie_free(request->cookie);
+    bhttp_free(request->cookies);
+    bhttp_free(request->cookie_slots);
+    bhttp_free(request->params);
+    bhttp_free(request->param_slots);
+    bhttp_free(request->param_names);
     bstr_free_contents(&request->body);
+    if (request->body_fd >= 0)
+        close(request->body_fd);
+    if (request->multipart != NULL)
+    {
+        bhttp_multipart_free(request->multipart);
+        bhttp_free(request->multipart);
+    }
+    if (request->splice_pipe[0] >= 0)
+    {
+        close(request->splice_pipe[0]);
+        close(request->splice_pipe[1]);
+    }
+    if (request->route_args != NULL)
+        bvec_free(request->route_args);
 }
 
 //static void
 //print_headers(bhttp_request *request)
 ///* prints headers for debugging */
 //{
-//    bvec *headers = &request->headers;
-//    for (int i = 0; i < bvec_count(headers); i++)
+//    for (int i = 0; i < request->header_count; i++)
 //    {
-//        bhttp_header *h = (bhttp_header *)bvec_get(headers, i);
-//        printf("%s: %s\n", bstr_cstring(&h->field), bstr_cstring(&h->value));
+//        bhttp_req_header *h = &request->headers[i];
+//        printf("%.*s: %.*s\n", (int)h->field_len, request->rb->data + h->field_off,
+//               (int)h->value_len, request->rb->data + h->value_off);
 //    }
 //    printf("\n");
 //}
@@ -110,33 +186,19 @@ static int
 url_decode(const char *source, bstr *dest, size_t length)
 /* decodes URL string and append to dest (eg '+' -> ' ' and % hex codes) */
 {
-    size_t n = 0;
-    char c, hex1, hex2;
     if (source == NULL || length == 0)
-    {
         return 0;
-    }
 
-    while((c = *source) != '\0' && n < length)
-    {
-        if(c == '%')
-        {
-            if((hex1 = unhex_tbl[(unsigned char)*++source]) < 0 ||
-               (hex2 = unhex_tbl[(unsigned char)*++source]) < 0) {
-                return 1;
-            }
-            c = (hex1 << 4) | hex2;
-            n += 2;
-        }
-        else if (c == '+')
-        {
-            c = ' ';
-        }
-        bstr_append_char(dest, c);
-        n++;
-        source ++;
-    }
-    return 0;
+    /* decoded strings are never longer */
+    char stack[URL_DECODE_STACK];
+    char *buf = length <= sizeof stack ? stack : bhttp_malloc(length);
+    if (buf == NULL)
+        return 1;
+    long n = bhttp_url_decode(source, length, buf);
+    int r = n < 0 || bstr_append_cstring(dest, buf, (uint64_t)n) != BS_SUCCESS;
+    if (buf != stack)
+        bhttp_free(buf);
+    return r;
 }
 
 static int
@@ -184,30 +246,188 @@ wait_for_sock(int sock)
     return sel;
 }
 
+void
+bhttp_readbuf_init(bhttp_readbuf *rb)
+{
+    rb->data = NULL;
+    rb->size = 0;
+    rb->capacity = 0;
+    rb->parsed = 0;
+}
+
+void
+bhttp_readbuf_free(bhttp_readbuf *rb)
+{
+    free(rb->data);
+    bhttp_readbuf_init(rb);
+}
+
+char *
+bhttp_readbuf_reserve(bhttp_readbuf *rb, size_t len)
+{
+    if (rb->capacity - rb->size < len)
+    {
+        size_t capacity = rb->capacity ? rb->capacity : REQUEST_BUF_SIZE;
+        while (capacity - rb->size < len)
+            capacity *= 2;
+        char *data = realloc(rb->data, capacity);
+        if (data == NULL)
+            return NULL;
+        rb->data = data;
+        rb->capacity = capacity;
+    }
+    return rb->data + rb->size;
+}
+
+int
+bhttp_readbuf_append(bhttp_readbuf *rb, const char *buf, size_t len)
+{
+    char *dest = bhttp_readbuf_reserve(rb, len);
+    if (dest == NULL)
+        return 1;
+    memcpy(dest, buf, len);
+    rb->size += len;
+    return 0;
+}
+
+void
+bhttp_readbuf_shrink(bhttp_readbuf *rb)
+{
+    if (rb->size == 0 && rb->data != NULL)
+        bhttp_readbuf_free(rb);
+}
+
+int
+bhttp_request_feed(bhttp_request *request, bhttp_readbuf *rb)
+{
+    if (request->done)
+        return BHTTP_REQ_OK;
+
+    /* new request, the previous one is answered so its bytes can go */
+    if (request->rb == NULL)
+    {
+        if (rb->parsed > 0)
+        {
+            memmove(rb->data, rb->data + rb->parsed, rb->size - rb->parsed);
+            rb->size -= rb->parsed;
+            rb->parsed = 0;
+        }
+        request->rb = rb;
+    }
+    if (rb->parsed == rb->size)
+        return BHTTP_REQ_OK;
+    if (request->start_ms == 0)
+        request->start_ms = now_ms();
+
+    int r = BHTTP_REQ_OK;
+#ifdef FASTPARSE
+    if (request->engine != BHTTP_ENGINE_HTTP_PARSER &&
+        (r = fast_feed(request, rb)) == FAST_FALLBACK)
+    {
+        request->engine = BHTTP_ENGINE_HTTP_PARSER;
+        r = BHTTP_REQ_OK;
+    }
+#endif
+    if (request->engine == BHTTP_ENGINE_HTTP_PARSER)
+    {
+        http_parser *parser = &(request->parser);
+        rb->parsed += http_parser_execute(parser, &parser_settings,
+                                          rb->data + rb->parsed, rb->size - rb->parsed);
+        /* a refused request is answered, callbacks stop the parser for it */
+        if (request->reject)
+            return BHTTP_REQ_OK;
+        /* message_end_cb pauses the parser so it stops right after the request */
+        if (parser->http_errno != HPE_OK && parser->http_errno != HPE_PAUSED)
+        {
+            fprintf(stderr, "parser error: %s\n", http_errno_description(parser->http_errno));
+            return BHTTP_REQ_ERROR;
+        }
+    }
+
+    if (!request->done && request->server != NULL)
+        read_limits(request, rb);
+
+    /* body bytes have been copied out, only the head is kept */
+    if (request->head_done && rb->parsed > request->head_end)
+    {
+        memmove(rb->data + request->head_end, rb->data + rb->parsed, rb->size - rb->parsed);
+        rb->size -= rb->parsed - request->head_end;
+        rb->parsed = request->head_end;
+    }
+    return r;
+}
+
+int
+bhttp_request_continue(bhttp_request *request, bhttp_out *out)
+{
+    if (!request->expect_continue || request->done)
+        return 0;
+    request->expect_continue = 0;
+    return bhttp_out_buffer(out, BHTTP_CONTINUE, sizeof BHTTP_CONTINUE - 1) == 0;
+}
+
+int
+bhttp_req_body_fd(const bhttp_request *req)
+{
+    return req->body_fd;
+}
+
+uint64_t
+bhttp_req_body_size(const bhttp_request *req)
+{
+    return req->body_size;
+}
+
 int
-receive_data(bhttp_request *request, int sock)
+bhttp_request_started(const bhttp_request *request)
+{
+    return request->rb != NULL && request->rb->parsed > 0;
+}
+
+int
+receive_data(bhttp_request *request, bhttp_readbuf *rb, int sock)
 /* reads data from socket */
 {
-    http_parser *parser = &(request->parser);
-    http_parser_settings *settings = &(request->settings);
-    char buf[REQUEST_BUF_SIZE];
     ssize_t n_recvd = 0;
     int sel;
 
+    /* written straight to the socket */
+    bhttp_out out;
+    bhttp_out_init(&out, sock, 0, 0);
+
+    /* a pipelined request may already be waiting in the buffer */
+    if (bhttp_request_feed(request, rb) != BHTTP_REQ_OK)
+        return BHTTP_REQ_ERROR;
+    if (request->done)
+        return BHTTP_REQ_OK;
+    bhttp_request_continue(request, &out);
+
     /* wait on socket, read chunk, parse, repeat */
-    while((sel = wait_for_sock(sock) > 0) &&
-          (n_recvd = recv(sock, buf, REQUEST_BUF_SIZE, 0)) > 0)
+    while((sel = wait_for_sock(sock) > 0))
     {
-        http_parser_execute(parser, settings, buf, n_recvd);
-        if (parser->http_errno != HPE_OK)
+        if (bhttp_request_splice_left(request) > 0)
         {
-            fprintf(stderr, "parser error: %s\n", http_errno_description(parser->http_errno));
-            return BHTTP_REQ_ERROR;
+            if (bhttp_request_splice(request, sock) != BHTTP_REQ_OK)
+                return BHTTP_REQ_ERROR;
+            if (request->done)
+                return BHTTP_REQ_OK;
+            continue;
         }
+
+        char *buf = bhttp_readbuf_reserve(rb, REQUEST_BUF_SIZE);
+        if (buf == NULL)
+            return BHTTP_REQ_ERROR;
+        if ((n_recvd = recv(sock, buf, rb->capacity - rb->size, 0)) <= 0)
+            break;
+        rb->size += (size_t)n_recvd;
+
+        if (bhttp_request_feed(request, rb) != BHTTP_REQ_OK)
+            return BHTTP_REQ_ERROR;
         //print_headers(request);
 
         if (request->done)
             break;
+        bhttp_request_continue(request, &out);
     }
 
     /* why did we break */
@@ -234,21 +454,72 @@ receive_data(bhttp_request *request, int sock)
 /*
  * Headers
  */
-bhttp_header *
-bhttp_req_get_header(bhttp_request *req, const char *field)
-/* returns the bhttp_header request header with the given field */
+static bhttp_header *
+header_build(bhttp_request *req, bhttp_req_header *rh)
+/* copies a header out of the read buffer the first time it is asked for */
 {
-    bvec *headers = &req->headers;
-    for (int i = 0; i < bvec_count(headers); i++)
+    if (rh->h != NULL)
+        return rh->h;
+
+    /* handlers call this, but the request owns what it builds */
+    int heap = bhttp_arena_heap_only(0);
+    bhttp_header *h = bhttp_header_new();
+    int r = h != NULL ? BS_SUCCESS : BS_FAIL;
+    const char *data = req->rb->data;
+    if (r == BS_SUCCESS)
+        r = bstr_append_cstring(&h->field, data + rh->field_off, rh->field_len);
+    if (r == BS_SUCCESS && rh->value_len > 0)
+        r = bstr_append_cstring(&h->value, data + rh->value_off, rh->value_len);
+    bhttp_arena_heap_only(heap);
+    if (r != BS_SUCCESS)
     {
-        bhttp_header *cur = (bhttp_header *)bvec_get(headers, i);
-        bstr *hf = &cur->field;
-        if (strcasecmp(field, bstr_cstring(hf)) == 0)
-            return cur;
+        if (h != NULL) bhttp_header_free(h);
+        return NULL;
+    }
+    /* field names were always handed out in lower case */
+    char *f = (char *)bstr_cstring(&h->field);
+    for (size_t i = 0; i < rh->field_len; i++)
+        f[i] = (char)tolower((unsigned char)f[i]);
+    rh->h = h;
+    return h;
+}
+
+static bhttp_req_header *
+header_find(bhttp_request *req, const char *field)
+{
+    size_t len = strlen(field);
+    int k = bhttp_header_known(field, len);
+    if (k != BHTTP_H_UNKNOWN)
+        return req->known[k] ? &req->headers[req->known[k] - 1] : NULL;
+
+    for (int i = 0; i < req->header_count; i++)
+    {
+        bhttp_req_header *rh = &req->headers[i];
+        if (rh->field_len == len &&
+            strncasecmp(field, req->rb->data + rh->field_off, len) == 0)
+            return rh;
     }
     return NULL;
 }
 
+bhttp_header *
+bhttp_req_get_header(bhttp_request *req, const char *field)
+/* returns the bhttp_header request header with the given field */
+{
+    bhttp_req_header *rh = header_find(req, field);
+    if (rh == NULL)
+        return NULL;
+    return header_build(req, rh);
+}
+
+bhttp_header *
+bhttp_req_get_known_header(bhttp_request *req, bhttp_known_header field)
+{
+    if ((int)field < 0 || field >= BHTTP_H_COUNT || req->known[field] == 0)
+        return NULL;
+    return header_build(req, &req->headers[req->known[field] - 1]);
+}
+
 /*
  * Cookies
  */
@@ -256,21 +527,737 @@ bhttp_cookie *
 bhttp_req_get_cookie(bhttp_request *req)
 /* returns the cookie header, parsed into a bhttp_cookie struct */
 {
-    bvec *headers = &req->headers;
-    for (int i = 0; i < bvec_count(headers); i++)
+    bhttp_header *h = bhttp_req_get_known_header(req, BHTTP_H_COOKIE);
+    if (h == NULL)
+        return NULL;
+    /* parsed once, later calls get the same entries */
+    if (req->cookie != NULL)
+        return req->cookie;
+    int heap = bhttp_arena_heap_only(0);
+    req->cookie = bhttp_cookie_new();
+    if (req->cookie != NULL)
+        bhttp_cookie_parse(req->cookie, bstr_cstring(&h->value));
+    bhttp_arena_heap_only(heap);
+    return req->cookie;
+}
+
+static unsigned
+name_hash(const char *name, size_t len)
+/* FNV-1a, cookie and parameter names are case sensitive */
+{
+    unsigned hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+static int
+cookie_add(bhttp_request *req, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    if (req->cookie_count == req->cookie_capacity)
+    {
+        int capacity = req->cookie_capacity ? req->cookie_capacity * 2 : 8;
+        bhttp_req_cookie *cookies = bhttp_realloc(req->cookies, sizeof(bhttp_req_cookie) * (size_t)capacity);
+        if (cookies == NULL)
+            return 1;
+        req->cookies = cookies;
+        req->cookie_capacity = capacity;
+    }
+    if (req->cookie_slots == NULL &&
+        (req->cookie_slots = bhttp_calloc(BHTTP_COOKIE_SLOTS, 1)) == NULL)
+        return 1;
+    bhttp_req_cookie *c = &req->cookies[req->cookie_count++];
+    c->name = name;
+    c->name_len = name_len;
+    c->value = value;
+    c->value_len = value_len;
+
+    /* the first cookie of a name wins, later ones are only seen by bhttp_req_cookie_at */
+    if (req->cookie_count > BHTTP_COOKIE_SLOTS * 3 / 4)
+        return 0;
+    unsigned slot = name_hash(name, name_len) & (BHTTP_COOKIE_SLOTS - 1);
+    while (req->cookie_slots[slot] != 0)
+    {
+        bhttp_req_cookie *o = &req->cookies[req->cookie_slots[slot] - 1];
+        if (o->name_len == name_len && memcmp(o->name, name, name_len) == 0)
+            return 0;
+        slot = (slot + 1) & (BHTTP_COOKIE_SLOTS - 1);
+    }
+    req->cookie_slots[slot] = (unsigned char)req->cookie_count;
+    return 0;
+}
+
+static void
+cookies_parse(bhttp_request *req)
+/* splits the cookie header into name=value pairs, tolerating missing or
+ * extra whitespace and skipping pairs without a name or '=' */
+{
+    req->cookies_parsed = 1;
+    if (req->known[BHTTP_H_COOKIE] == 0)
+        return;
+    bhttp_req_header *rh = &req->headers[req->known[BHTTP_H_COOKIE] - 1];
+    const char *p = req->rb->data + rh->value_off;
+    const char *end = p + rh->value_len;
+
+    int heap = bhttp_arena_heap_only(0);
+    while (p < end)
     {
-        bhttp_header *cur = (bhttp_header *)bvec_get(headers, i);
-        bstr *hf = &cur->field;
-        if (strcasecmp("cookie", bstr_cstring(hf)) == 0)
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+            p++;
+        const char *pair_end = memchr(p, ';', (size_t)(end - p));
+        if (pair_end == NULL)
+            pair_end = end;
+        const char *eq = memchr(p, '=', (size_t)(pair_end - p));
+        if (eq != NULL)
         {
-            printf("Cooke: %s\n", bstr_cstring(&cur->value));
-            bhttp_cookie_parse(req->cookie, bstr_cstring(&cur->value));
-            return req->cookie;
+            const char *name_end = eq;
+            while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+                name_end--;
+            const char *v = eq + 1;
+            const char *v_end = pair_end;
+            while (v < v_end && (*v == ' ' || *v == '\t'))
+                v++;
+            while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+                v_end--;
+            if (v_end - v >= 2 && *v == '"' && v_end[-1] == '"')
+            {
+                v++;
+                v_end--;
+            }
+            if (name_end > p &&
+                cookie_add(req, p, (size_t)(name_end - p), v, (size_t)(v_end - v)) != 0)
+                break;
         }
+        p = pair_end;
+    }
+    bhttp_arena_heap_only(heap);
+}
+
+const bhttp_req_cookie *
+bhttp_req_cookie_get(bhttp_request *req, const char *name)
+{
+    if (!req->cookies_parsed)
+        cookies_parse(req);
+    if (req->cookie_count == 0)
+        return NULL;
+
+    size_t len = strlen(name);
+    unsigned slot = name_hash(name, len) & (BHTTP_COOKIE_SLOTS - 1);
+    while (req->cookie_slots[slot] != 0)
+    {
+        bhttp_req_cookie *c = &req->cookies[req->cookie_slots[slot] - 1];
+        if (c->name_len == len && memcmp(c->name, name, len) == 0)
+            return c;
+        slot = (slot + 1) & (BHTTP_COOKIE_SLOTS - 1);
+    }
+    /* too many cookies to hash them all */
+    for (int i = BHTTP_COOKIE_SLOTS * 3 / 4; i < req->cookie_count; i++)
+    {
+        bhttp_req_cookie *c = &req->cookies[i];
+        if (c->name_len == len && memcmp(c->name, name, len) == 0)
+            return c;
     }
     return NULL;
 }
 
+int
+bhttp_req_cookie_count(bhttp_request *req)
+{
+    if (!req->cookies_parsed)
+        cookies_parse(req);
+    return req->cookie_count;
+}
+
+const bhttp_req_cookie *
+bhttp_req_cookie_at(bhttp_request *req, int i)
+{
+    if (!req->cookies_parsed)
+        cookies_parse(req);
+    if (i < 0 || i >= req->cookie_count)
+        return NULL;
+    return &req->cookies[i];
+}
+
+/*
+ * Query parameters
+ */
+static int
+param_add(bhttp_request *req, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    if (req->param_count == req->param_capacity)
+    {
+        int capacity = req->param_capacity ? req->param_capacity * 2 : 16;
+        bhttp_req_param *params = bhttp_realloc(req->params, sizeof(bhttp_req_param) * (size_t)capacity);
+        if (params == NULL)
+            return 1;
+        req->params = params;
+        req->param_capacity = capacity;
+    }
+    if (req->param_slots == NULL &&
+        (req->param_slots = bhttp_calloc(BHTTP_PARAM_SLOTS, sizeof(int))) == NULL)
+        return 1;
+    int index = req->param_count++;
+    bhttp_req_param *p = &req->params[index];
+    p->name = name;
+    p->name_len = name_len;
+    p->value = value;
+    p->value_len = value_len;
+    p->next = -1;
+    p->last = index;
+
+    /* the first of each name is hashed, later ones hang off its last */
+    unsigned slot = name_hash(name, name_len) & (BHTTP_PARAM_SLOTS - 1);
+    while (req->param_slots[slot] != 0)
+    {
+        bhttp_req_param *first = &req->params[req->param_slots[slot] - 1];
+        if (first->name_len == name_len && memcmp(first->name, name, name_len) == 0)
+        {
+            req->params[first->last].next = index;
+            first->last = index;
+            return 0;
+        }
+        slot = (slot + 1) & (BHTTP_PARAM_SLOTS - 1);
+    }
+    /* names past 3/4 of the table are found by bhttp_req_param_get in order */
+    if (req->param_names_count < BHTTP_PARAM_SLOTS * 3 / 4)
+    {
+        req->param_slots[slot] = index + 1;
+        req->param_names_count++;
+    }
+    return 0;
+}
+
+static void
+params_parse(bhttp_request *req)
+/* splits the query string on '&' and '=', names with escapes are the only
+ * thing decoded up front so lookups can compare them directly */
+{
+    req->params_parsed = 1;
+    const char *p = bstr_cstring(&req->uri_query);
+    const char *end = p + bstr_size(&req->uri_query);
+
+    int heap = bhttp_arena_heap_only(0);
+    while (p < end)
+    {
+        const char *pair_end = memchr(p, '&', (size_t)(end - p));
+        if (pair_end == NULL)
+            pair_end = end;
+        const char *eq = memchr(p, '=', (size_t)(pair_end - p));
+        const char *name_end = eq != NULL ? eq : pair_end;
+        const char *value = eq != NULL ? eq + 1 : pair_end;
+        const char *name = p;
+        size_t name_len = (size_t)(name_end - p);
+
+        if (memchr(name, '%', name_len) != NULL || memchr(name, '+', name_len) != NULL)
+        {
+            /* decoded names are never longer, so they all fit in one query sized buffer */
+            if (req->param_names == NULL)
+                req->param_names = bhttp_malloc((size_t)(end - bstr_cstring(&req->uri_query)));
+            if (req->param_names != NULL)
+            {
+                char *dest = req->param_names + req->param_names_used;
+                long n = bhttp_url_decode(name, name_len, dest);
+                if (n >= 0)
+                {
+                    name = dest;
+                    name_len = (size_t)n;
+                    req->param_names_used += (size_t)n;
+                }
+            }
+        }
+
+        if (name_len > 0 &&
+            param_add(req, name, name_len, value, (size_t)(pair_end - value)) != 0)
+            break;
+        p = pair_end + 1;
+    }
+    bhttp_arena_heap_only(heap);
+}
+
+const bhttp_req_param *
+bhttp_req_param_get(bhttp_request *req, const char *name)
+{
+    if (!req->params_parsed)
+        params_parse(req);
+    if (req->param_count == 0)
+        return NULL;
+
+    size_t len = strlen(name);
+    unsigned slot = name_hash(name, len) & (BHTTP_PARAM_SLOTS - 1);
+    while (req->param_slots[slot] != 0)
+    {
+        bhttp_req_param *p = &req->params[req->param_slots[slot] - 1];
+        if (p->name_len == len && memcmp(p->name, name, len) == 0)
+            return p;
+        slot = (slot + 1) & (BHTTP_PARAM_SLOTS - 1);
+    }
+    /* the table filled up, only then can the name be elsewhere */
+    if (req->param_names_count < BHTTP_PARAM_SLOTS * 3 / 4)
+        return NULL;
+    for (int i = 0; i < req->param_count; i++)
+    {
+        bhttp_req_param *p = &req->params[i];
+        if (p->name_len == len && memcmp(p->name, name, len) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+const bhttp_req_param *
+bhttp_req_param_next(bhttp_request *req, const bhttp_req_param *p)
+{
+    if (p->next >= 0)
+        return &req->params[p->next];
+    /* unhashed names are not chained, look for the next one in order */
+    if (req->param_names_count < BHTTP_PARAM_SLOTS * 3 / 4)
+        return NULL;
+    for (int i = (int)(p - req->params) + 1; i < req->param_count; i++)
+    {
+        bhttp_req_param *o = &req->params[i];
+        if (o->name_len == p->name_len && memcmp(o->name, p->name, p->name_len) == 0)
+            return o;
+    }
+    return NULL;
+}
+
+int
+bhttp_req_param_count(bhttp_request *req)
+{
+    if (!req->params_parsed)
+        params_parse(req);
+    return req->param_count;
+}
+
+const bhttp_req_param *
+bhttp_req_param_at(bhttp_request *req, int i)
+{
+    if (!req->params_parsed)
+        params_parse(req);
+    if (i < 0 || i >= req->param_count)
+        return NULL;
+    return &req->params[i];
+}
+
+int
+bhttp_req_param_decode(const bhttp_req_param *p, bstr *dest)
+{
+    return url_decode(p->value, dest, p->value_len);
+}
+
+static bhttp_req_header *
+header_add(bhttp_request *req)
+{
+    if (req->header_count == req->header_capacity)
+    {
+        int capacity = req->header_capacity ? req->header_capacity * 2 : 16;
+        bhttp_req_header *headers = bhttp_realloc(req->headers, sizeof(bhttp_req_header) * (size_t)capacity);
+        if (headers == NULL)
+            return NULL;
+        req->headers = headers;
+        req->header_capacity = capacity;
+    }
+    bhttp_req_header *h = &req->headers[req->header_count++];
+    memset(h, 0, sizeof(bhttp_req_header));
+    return h;
+}
+
+static void
+header_classify(bhttp_request *req, int index, int known)
+/* records the first header of each known kind */
+{
+    if (known != BHTTP_H_UNKNOWN && req->known[known] == 0)
+        req->known[known] = (unsigned short)(index + 1);
+}
+
+/*
+ * Limits
+ */
+static int
+request_reject(bhttp_request *req, int code)
+/* ends the request early, it is answered with code and the connection closed */
+{
+    req->reject = code;
+    req->keep_alive = BHTTP_CLOSE;
+    req->done = 1;
+    return 1;
+}
+
+/* counts a request refused for one of the server's limits */
+#define LIMIT_HIT(req, stat) \
+    ((req)->server != NULL ? (void)__atomic_add_fetch(&(req)->server->limit_stats.stat, 1, __ATOMIC_RELAXED) : (void)0)
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int
+head_limits(bhttp_request *req)
+/* returns 1 if the complete head is over a limit */
+{
+    if (req->server == NULL)
+        return 0;
+    const bhttp_limits *l = &req->server->limits;
+    if (l->max_uri > 0 && (size_t)bstr_size(&req->uri) > l->max_uri)
+    {
+        LIMIT_HIT(req, uris_too_long);
+        return request_reject(req, BHTTP_414);
+    }
+    if (l->max_headers > 0 && req->header_count > l->max_headers)
+    {
+        LIMIT_HIT(req, too_many_headers);
+        return request_reject(req, BHTTP_431);
+    }
+    if (l->max_head_size > 0 && req->head_end > l->max_head_size)
+    {
+        LIMIT_HIT(req, heads_too_large);
+        return request_reject(req, BHTTP_431);
+    }
+    return 0;
+}
+
+static void
+body_rate(bhttp_request *req)
+/* refuses a body arriving slower than min_rate, after a grace period */
+{
+    size_t min_rate = req->server->limits.min_rate;
+    if (min_rate == 0 || req->done)
+        return;
+    uint64_t elapsed = now_ms() - req->head_ms;
+    if (elapsed > TIMEOUT_SECONDS * 1000 && req->body_size * 1000 < (uint64_t)min_rate * elapsed)
+    {
+        LIMIT_HIT(req, slow_bodies);
+        request_reject(req, BHTTP_408);
+    }
+}
+
+static void
+read_limits(bhttp_request *req, bhttp_readbuf *rb)
+/* checked whenever bytes arrive, a client trickling a request in has to
+ * keep sending so it is caught here. idle ones hit the connection timeout */
+{
+    const bhttp_limits *l = &req->server->limits;
+    if (req->head_done)
+        body_rate(req);
+    else if (l->max_head_size > 0 && rb->size > l->max_head_size)
+    {
+        LIMIT_HIT(req, heads_too_large);
+        request_reject(req, BHTTP_431);
+    }
+    else if (l->head_timeout > 0 && now_ms() - req->start_ms > (uint64_t)l->head_timeout * 1000)
+    {
+        LIMIT_HIT(req, head_timeouts);
+        request_reject(req, BHTTP_408);
+    }
+}
+
+static void
+header_unfold(bhttp_request *req, bhttp_req_header *h)
+/* replaces each line break of a folded value, with the whitespace around
+ * it, by a single space. done in place, as the value only gets shorter */
+{
+    char *v = req->rb->data + h->value_off;
+    char *end = v + h->value_len;
+    char *out = v;
+    for (char *p = v; p < end;)
+    {
+        if (*p != '\r' && *p != '\n')
+        {
+            *out++ = *p++;
+            continue;
+        }
+        while (out > v && (out[-1] == ' ' || out[-1] == '\t'))
+            out--;
+        while (p < end && (*p == '\r' || *p == '\n' || *p == ' ' || *p == '\t'))
+            p++;
+        *out++ = ' ';
+    }
+    h->value_len = (size_t)(out - v);
+}
+
+static int
+head_complete(bhttp_request *req)
+/* work left once every header is in, for either parser */
+{
+    /* everything past the last header can be dropped from rb */
+    if (req->header_count > 0)
+    {
+        bhttp_req_header *h = &req->headers[req->header_count - 1];
+        req->head_end = h->value_off ? h->value_off + h->value_len : h->field_off + h->field_len;
+    }
+    /* handlers, and everything here reading values in place, would see the
+     * raw line breaks. only http_parser accepts folds */
+    for (int i = 0; req->folded && i < req->header_count; i++)
+    {
+        bhttp_req_header *h = &req->headers[i];
+        if (h->value_off != 0 && memchr(req->rb->data + h->value_off, '\n', h->value_len) != NULL)
+            header_unfold(req, h);
+    }
+    req->head_done = 1;
+    req->head_ms = now_ms();
+    if (head_limits(req) != 0)
+        return 1;
+    /* parse URI */
+    return url_to_path_and_query(req);
+}
+
+/*
+ * Body
+ */
+
+static int
+body_multipart(bhttp_request *req)
+/* starts a multipart parser if the content-type asks for one
+ * returns 1 for a multipart type without a usable boundary */
+{
+    int ct = req->known[BHTTP_H_CONTENT_TYPE];
+    if (ct == 0)
+        return 0;
+    bhttp_req_header *h = &req->headers[ct - 1];
+    const char *v = req->rb->data + h->value_off;
+    if (h->value_len < 10 || strncasecmp(v, "multipart/", 10) != 0)
+        return 0;
+    bhttp_multipart *mp = bhttp_malloc(sizeof(bhttp_multipart));
+    if (mp == NULL)
+        return 1;
+    if (bhttp_multipart_init(mp, v, h->value_len, &req->body_opts.multipart) != 0)
+    {
+        bhttp_free(mp);
+        return 1;
+    }
+    req->multipart = mp;
+    return 0;
+}
+
+static int
+body_expect(bhttp_request *req, uint64_t content_length, int minor)
+/* handles an Expect header once the route has taken the body, the client
+ * waits for 100 Continue or the final response. returns 1 if it is refused */
+{
+    bhttp_req_header *h = &req->headers[req->known[BHTTP_H_EXPECT] - 1];
+    if (h->value_len != 12 || strncasecmp(req->rb->data + h->value_off, "100-continue", 12) != 0)
+        return request_reject(req, BHTTP_417);
+    /* HTTP/1.0 clients do not know 100 Continue, and without a body there
+     * is nothing to wait for */
+    if (minor == 0 || content_length == 0)
+        return 0;
+    req->expect_continue = 1;
+    return 0;
+}
+
+static int
+body_start(bhttp_request *req, uint64_t content_length, int minor)
+/* picks the route's body options, UINT64_MAX for a chunked body, minor is
+ * the request's HTTP/1.x version. returns 1 if the request is refused */
+{
+    bhttp_body_opts *o = &req->body_opts;
+    if (req->server != NULL)
+        bhttp_server_route(req->server, req);
+    req->body_expect = content_length;
+    /* nothing would read the body, refuse it before any of it is stored */
+    if (req->route != 0 && content_length > 0)
+        return request_reject(req, req->route);
+    if (o->max_size > 0 && content_length != UINT64_MAX && content_length > o->max_size)
+    {
+        LIMIT_HIT(req, bodies_too_large);
+        return request_reject(req, BHTTP_413);
+    }
+    /* refused before the client sends a body it would be refused for */
+    if (req->known[BHTTP_H_EXPECT] != 0 && body_expect(req, content_length, minor) != 0)
+        return 1;
+    if ((o->multipart.on_part != NULL || o->multipart.on_data != NULL) &&
+        o->on_body == NULL && content_length > 0 && body_multipart(req) != 0)
+        return request_reject(req, BHTTP_400);
+    if (o->upload_fd != NULL && o->on_body == NULL && req->multipart == NULL && content_length > 0)
+    {
+        int heap = bhttp_arena_heap_only(1);
+        req->body_fd = o->upload_fd(req, o->arg);
+        bhttp_arena_heap_only(heap);
+        if (req->body_fd < 0)
+            return request_reject(req, BHTTP_500);
+    }
+    return 0;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+body_spill(bhttp_request *req)
+/* moves the body so far to an unlinked temp file, the rest follows it there */
+{
+    const char *dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof path, "%s/bhttp-body-XXXXXX", dir != NULL && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    if (write_all(fd, bstr_cstring(&req->body), (size_t)bstr_size(&req->body)) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    bstr_free_contents(&req->body);
+    bstr_init(&req->body);
+    req->body_fd = fd;
+    return 0;
+}
+
+static int
+body_add(bhttp_request *req, const char *at, size_t len)
+/* returns 1 if the request is refused */
+{
+    bhttp_body_opts *o = &req->body_opts;
+    if (o->max_size > 0 && req->body_size + len > o->max_size)
+    {
+        LIMIT_HIT(req, bodies_too_large);
+        return request_reject(req, BHTTP_413);
+    }
+    req->body_size += len;
+
+    if (o->on_body != NULL)
+    {
+        int heap = bhttp_arena_heap_only(1);
+        int r = o->on_body(req, at, len, o->arg);
+        bhttp_arena_heap_only(heap);
+        return r != 0 ? request_reject(req, BHTTP_400) : 0;
+    }
+    if (req->multipart != NULL)
+    {
+        int code = bhttp_multipart_feed(req->multipart, req, at, len);
+        return code != 0 ? request_reject(req, code) : 0;
+    }
+    if (req->body_fd < 0 && o->spill_size > 0 && req->body_size > o->spill_size &&
+        body_spill(req) != 0)
+        return request_reject(req, BHTTP_500);
+    if (req->body_fd >= 0)
+        return write_all(req->body_fd, at, len) != 0 ? request_reject(req, BHTTP_500) : 0;
+    if (bstr_append_cstring(&req->body, at, len) != BS_SUCCESS)
+        return request_reject(req, BHTTP_500);
+    return 0;
+}
+
+static void
+body_end(bhttp_request *req)
+{
+    /* the closing delimiter never came */
+    if (req->multipart != NULL && !bhttp_multipart_complete(req->multipart))
+    {
+        request_reject(req, BHTTP_400);
+        return;
+    }
+    req->done = 1;
+    if (req->body_fd >= 0)
+        lseek(req->body_fd, 0, SEEK_SET);
+}
+
+uint64_t
+bhttp_request_splice_left(const bhttp_request *request)
+{
+    /* the parser has taken everything buffered, what is left is on the socket */
+    if (request->done || request->no_splice || request->body_opts.upload_fd == NULL ||
+        request->body_fd < 0 || request->body_expect == UINT64_MAX ||
+        request->rb == NULL || request->rb->parsed < request->rb->size)
+        return 0;
+    return request->body_expect - request->body_size;
+}
+
+static int
+pipe_drain(int from, int to, size_t len)
+/* moves len bytes out of a pipe, copying them if to cannot be spliced to */
+{
+    while (len > 0)
+    {
+        ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINVAL)
+        {
+            char buf[8192];
+            if ((n = read(from, buf, len < sizeof buf ? len : sizeof buf)) > 0 &&
+                write_all(to, buf, (size_t)n) != 0)
+                return 1;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+void
+bhttp_request_splice_pipe(bhttp_request *request, int pipe_rd, size_t n)
+{
+    if (pipe_drain(pipe_rd, request->body_fd, n) != 0)
+    {
+        perror("upload");
+        request_reject(request, BHTTP_500);
+        return;
+    }
+    request->body_size += n;
+    if (request->body_size == request->body_expect)
+        body_end(request);
+    else if (request->server != NULL)
+        body_rate(request);
+}
+
+int
+bhttp_request_splice(bhttp_request *request, int sock)
+{
+    uint64_t left;
+    while ((left = bhttp_request_splice_left(request)) > 0)
+    {
+        if (request->splice_pipe[0] < 0)
+        {
+            if (pipe(request->splice_pipe) != 0)
+                return BHTTP_REQ_ERROR;
+            /* fewer trips for big uploads, the default size is fine too */
+            fcntl(request->splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+        }
+        size_t len = left < SPLICE_PIPE_SIZE ? (size_t)left : SPLICE_PIPE_SIZE;
+        ssize_t n = splice(sock, NULL, request->splice_pipe[1], NULL, len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return BHTTP_REQ_OK;
+            if (errno != EINVAL)
+                return BHTTP_REQ_ERROR;
+            /* not a socket splice works on, read the rest */
+            request->no_splice = 1;
+            return BHTTP_REQ_OK;
+        }
+        /* client went away in the middle of the body */
+        if (n == 0)
+            return BHTTP_REQ_ERROR;
+        bhttp_request_splice_pipe(request, request->splice_pipe[0], (size_t)n);
+    }
+    return BHTTP_REQ_OK;
+}
+
 /*
  * HTTP Header parsing callbacks
  */
@@ -295,36 +1282,48 @@ header_field_cb(http_parser* parser, const char *at, size_t length)
 {
     if (length == 0) return 0;
     bhttp_request *request = parser->data;
-    bvec *headers = &(request->headers);
+    size_t off = (size_t)(at - request->rb->data);
 
-    int num_headers = bvec_count(headers);
-    bhttp_header *h = num_headers > 0 ? bvec_get(headers, num_headers - 1) : NULL;
-    /* if this is first header, or last cb was a value, make a new field */
-    if (h == NULL || bstr_size(&h->value) > 0)
+    bhttp_req_header *h = request->header_count > 0 ?
+                          &request->headers[request->header_count - 1] : NULL;
+    /* field continues from the previous read */
+    if (h != NULL && h->value_off == 0)
     {
-        h = bhttp_header_new();
-        if (h == NULL)
-            return 1;
-        bvec_add(headers, h);
+        h->field_len = off + length - h->field_off;
+        return 0;
     }
 
-    for (size_t i = 0; i < length; i++)
-    {
-        if (bstr_append_char(&h->field, (char)tolower((unsigned char)at[i])) != BS_SUCCESS)
-            return 1;
-    }
+    if ((h = header_add(request)) == NULL)
+        return 1;
+    h->field_off = off;
+    h->field_len = length;
     return 0;
 }
 
 int
 header_value_cb(http_parser* parser, const char *at, size_t length)
+/* also called with length 0 for empty values */
 {
-    if (length == 0) return 0;
     bhttp_request *request = parser->data;
-    bvec *headers = &(request->headers);
-    bhttp_header *h = (bhttp_header *)bvec_get(headers, bvec_count(headers) - 1);
-    if (bstr_append_cstring(&(h->value), at, length) != BS_SUCCESS)
-        return 1;
+    if (request->header_count == 0) return 1;
+    bhttp_req_header *h = &request->headers[request->header_count - 1];
+    size_t off = (size_t)(at - request->rb->data);
+    if (h->value_off == 0)
+    {
+        /* the field is complete once its value starts */
+        header_classify(request, request->header_count - 1,
+                        bhttp_header_known(request->rb->data + h->field_off, h->field_len));
+        h->value_off = off;
+        h->value_len = length;
+    }
+    else if (length > 0)
+    {
+        /* continued from the previous read, or a folded line when there
+         * is a line break in between */
+        if (off != h->value_off + h->value_len)
+            request->folded = 1;
+        h->value_len = off + length - h->value_off;
+    }
     return 0;
 }
 
@@ -332,19 +1331,23 @@ int
 header_end_cb(http_parser* parser)
 {
     bhttp_request *req = parser->data;
-    /* parse URI */
-    if (url_to_path_and_query(req) != 0)
-        return 1;
+    /* 1 would tell http_parser there is no body, anything else is an error */
+    if (head_complete(req) != 0)
+        return -1;
 
     /* get http methods */
     req->method = (int)parser->method > HTTP_TRACE ? BHTTP_UNSUPPORTED_METHOD : 1 << (int)parser->method;
+    req->http_minor = parser->http_minor;
     /* check keep-live */
     if (http_should_keep_alive(parser) == 0)
         req->keep_alive = BHTTP_CLOSE;
     else
         req->keep_alive = BHTTP_KEEP_ALIVE;
 
-    return 0;
+    /* requests without content-length or chunked encoding have no body */
+    uint64_t length = parser->flags & F_CHUNKED ? UINT64_MAX :
+                      parser->content_length == ULLONG_MAX ? 0 : parser->content_length;
+    return body_start(req, length, parser->http_minor) ? -1 : 0;
 }
 
 int
@@ -352,15 +1355,170 @@ body_cb(http_parser* parser, const char *at, size_t length)
 {
     if (length == 0) return 0;
     bhttp_request *request = parser->data;
-    if (bstr_append_cstring(&(request->body), at, length) != BS_SUCCESS)
-        return 1;
-    return 0;
+    return body_add(request, at, length);
 }
 
 int
 message_end_cb(http_parser* parser)
 {
     bhttp_request *request = parser->data;
-    request->done = 1;
+    body_end(request);
+    /* stop here, anything after this belongs to the next request */
+    http_parser_pause(parser, 1);
     return 0;
 }
+
+#ifdef FASTPARSE
+/*
+ * fastparse engine, takes the whole head in one pass once it has arrived and
+ * leaves anything it does not handle to http_parser
+ */
+static const struct {
+    const char *name;
+    size_t len;
+    enum http_method method;
+} fast_methods[] = {
+    {"GET",     3, HTTP_GET},
+    {"POST",    4, HTTP_POST},
+    {"HEAD",    4, HTTP_HEAD},
+    {"PUT",     3, HTTP_PUT},
+    {"DELETE",  6, HTTP_DELETE},
+    {"OPTIONS", 7, HTTP_OPTIONS},
+    {"TRACE",   5, HTTP_TRACE}
+};
+
+static int
+has_token(const char *v, size_t len, const char *token)
+/* checks a comma separated header value for token, ignoring case */
+{
+    size_t tlen = strlen(token);
+    size_t i = 0;
+    while (i < len)
+    {
+        while (i < len && (v[i] == ' ' || v[i] == '\t' || v[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < len && v[i] != ',')
+            i++;
+        size_t e = i;
+        while (e > start && (v[e-1] == ' ' || v[e-1] == '\t'))
+            e--;
+        if (e - start == tlen && strncasecmp(v + start, token, tlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int
+fast_head(bhttp_request *request, bhttp_readbuf *rb)
+/* returns BHTTP_REQ_OK, BHTTP_REQ_ERROR or FAST_FALLBACK */
+{
+    bhttp_fast_header fh[FAST_MAX_HEADERS];
+    bhttp_fast_head head;
+    head.headers = fh;
+    head.num_headers = FAST_MAX_HEADERS;
+    size_t len = rb->size - rb->parsed;
+    int n = bhttp_fast_parse_head(rb->data + rb->parsed, len, &head);
+    if (n == BHTTP_FAST_INCOMPLETE)
+        /* http_parser reports heads that are too big */
+        return len > HTTP_MAX_HEADER_SIZE ? FAST_FALLBACK : BHTTP_REQ_OK;
+    if (n < 0)
+        return FAST_FALLBACK;
+
+    int method = -1;
+    for (size_t i = 0; i < sizeof fast_methods / sizeof fast_methods[0]; i++)
+    {
+        if (head.method_len == fast_methods[i].len &&
+            memcmp(head.method, fast_methods[i].name, head.method_len) == 0)
+        {
+            method = fast_methods[i].method;
+            break;
+        }
+    }
+    if (method < 0)
+        return FAST_FALLBACK;
+
+    /* message framing, chunked bodies and upgrades go to http_parser */
+    int has_length = 0, has_close = 0, has_keep_alive = 0;
+    uint64_t length = 0;
+    signed char known[FAST_MAX_HEADERS];
+    for (size_t i = 0; i < head.num_headers; i++)
+    {
+        bhttp_fast_header *h = &fh[i];
+        known[i] = (signed char)bhttp_header_known(h->name, h->name_len);
+        if (known[i] == BHTTP_H_CONTENT_LENGTH)
+        {
+            if (has_length || h->value_len == 0)
+                return FAST_FALLBACK;
+            for (size_t j = 0; j < h->value_len; j++)
+            {
+                char c = h->value[j];
+                if (c < '0' || c > '9' || length > (UINT64_MAX - 9) / 10)
+                    return FAST_FALLBACK;
+                length = length * 10 + (uint64_t)(c - '0');
+            }
+            has_length = 1;
+        }
+        else if (known[i] == BHTTP_H_TRANSFER_ENCODING || known[i] == BHTTP_H_UPGRADE)
+            return FAST_FALLBACK;
+        else if (known[i] == BHTTP_H_CONNECTION)
+        {
+            has_close |= has_token(h->value, h->value_len, "close");
+            has_keep_alive |= has_token(h->value, h->value_len, "keep-alive");
+        }
+    }
+
+    if (bstr_append_cstring(&request->uri, head.uri, head.uri_len) != BS_SUCCESS)
+        return BHTTP_REQ_ERROR;
+    for (size_t i = 0; i < head.num_headers; i++)
+    {
+        bhttp_req_header *h = header_add(request);
+        if (h == NULL)
+            return BHTTP_REQ_ERROR;
+        h->field_off = (size_t)(fh[i].name - rb->data);
+        h->field_len = fh[i].name_len;
+        h->value_off = (size_t)(fh[i].value - rb->data);
+        h->value_len = fh[i].value_len;
+        header_classify(request, request->header_count - 1, known[i]);
+    }
+    if (head_complete(request) != 0)
+        return request->reject ? BHTTP_REQ_OK : BHTTP_REQ_ERROR;
+
+    request->method = 1 << method;
+    request->http_minor = head.minor_version;
+    /* same rules as http_should_keep_alive */
+    if (head.minor_version > 0 ? !has_close : has_keep_alive)
+        request->keep_alive = BHTTP_KEEP_ALIVE;
+    else
+        request->keep_alive = BHTTP_CLOSE;
+
+    rb->parsed += (size_t)n;
+    request->body_left = length;
+    request->engine = BHTTP_ENGINE_FAST_BODY;
+    body_start(request, length, head.minor_version);
+    return BHTTP_REQ_OK;
+}
+
+static int
+fast_feed(bhttp_request *request, bhttp_readbuf *rb)
+{
+    if (request->engine == BHTTP_ENGINE_FAST_HEAD)
+    {
+        int r = fast_head(request, rb);
+        if (r != BHTTP_REQ_OK || request->engine == BHTTP_ENGINE_FAST_HEAD || request->reject)
+            return r;
+    }
+
+    /* content-length body */
+    size_t take = rb->size - rb->parsed;
+    if (take > request->body_left)
+        take = (size_t)request->body_left;
+    if (take > 0 && body_add(request, rb->data + rb->parsed, take) != 0)
+        return BHTTP_REQ_OK;
+    rb->parsed += take;
+    request->body_left -= take;
+    if (request->body_left == 0)
+        body_end(request);
+    return BHTTP_REQ_OK;
+}
+#endif
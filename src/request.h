@@ -18,17 +18,104 @@
 #include "http_parser.h"
 #include "bittystring.h"
 #include "bittyvec.h"
+#include "multipart.h"
 
 #define BHTTP_KEEP_ALIVE     0
 #define BHTTP_CLOSE          1
 
+/* bhttp_request.engine, FASTPARSE builds try fastparse before http_parser */
+#define BHTTP_ENGINE_FAST_HEAD      0
+#define BHTTP_ENGINE_FAST_BODY      1
+#define BHTTP_ENGINE_HTTP_PARSER    2
+
 #define TIMEOUT_SECONDS     5
 
+/* interim response for a client waiting on Expect: 100-continue */
+#define BHTTP_CONTINUE      "HTTP/1.1 100 Continue\r\n\r\n"
+
 typedef enum {
     BHTTP_REQ_OK = 0,
     BHTTP_REQ_ERROR
 } bhttp_request_ret;
 
+/* bytes read from a connection, kept across the requests of a keep-alive
+ * connection so pipelined requests survive. The head of the request being
+ * parsed stays at the front, its headers point into it */
+typedef struct bhttp_readbuf {
+    char *data;
+    size_t size;
+    size_t capacity;
+    /* bytes at the front already seen by the parser */
+    size_t parsed;
+} bhttp_readbuf;
+
+/* a request header as offsets into the read buffer, nothing is copied */
+typedef struct bhttp_req_header {
+    size_t field_off;
+    size_t field_len;
+    /* 0 until the value starts, the field always comes first */
+    size_t value_off;
+    size_t value_len;
+    /* built on first lookup by bhttp_req_get_header */
+    bhttp_header *h;
+} bhttp_req_header;
+
+/* a cookie from the cookie header, pointing into the request's read buffer
+ * until the request is freed. neither string is NUL terminated */
+typedef struct bhttp_req_cookie {
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} bhttp_req_cookie;
+
+/* hash slots for cookie names, cookies past 3/4 of this are searched in order */
+#define BHTTP_COOKIE_SLOTS 32
+
+/* a query string parameter, pointing into uri_query until the request is
+ * freed. the value is still percent-encoded, bhttp_req_param_decode
+ * decodes it. neither string is NUL terminated */
+typedef struct bhttp_req_param {
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+    /* index of the next parameter with this name, -1 for none */
+    int next;
+    /* on the first of a hashed name, index of the last with that name */
+    int last;
+} bhttp_req_param;
+
+/* hash slots for parameter names, names past 3/4 of this are searched in order */
+#define BHTTP_PARAM_SLOTS 64
+
+struct bhttp_request;
+struct bhttp_server;
+struct bhttp_out;
+struct bhttp_handler;
+
+/* how a request body is received, chosen per route once the head is parsed */
+typedef struct bhttp_body_opts {
+    /* larger bodies are refused with 413, before they arrive if a
+     * content-length says so. 0 for no limit */
+    uint64_t max_size;
+    /* bodies growing past this go to an unlinked temp file instead of
+     * req->body, see bhttp_req_body_fd. 0 keeps them in memory */
+    uint64_t spill_size;
+    /* if set, gets the body as it arrives and nothing is kept. it runs
+     * before the handler, non-zero refuses the request with 400 */
+    int (*on_body)(struct bhttp_request *req, const char *data, size_t len, void *arg);
+    /* if set, returns the fd a body is written to as it arrives, -1 refuses
+     * the request with 500. the rest of a content-length body is spliced
+     * from the socket without copying. the handler runs once it is all
+     * there, bittyhttp closes the fd when the request is freed */
+    int (*upload_fd)(struct bhttp_request *req, void *arg);
+    void *arg;
+    /* multipart bodies are split into parts as they arrive when on_part or
+     * on_data is set, see multipart.h. other bodies are read as usual */
+    bhttp_multipart_opts multipart;
+} bhttp_body_opts;
+
 /* struct is populated during receive_data calls */
 typedef struct bhttp_request {
     /* connection info */
@@ -39,16 +126,84 @@ typedef struct bhttp_request {
     bstr uri;
     bstr uri_path;
     bstr uri_query;
-    /* headers */
-    bvec headers;
+    /* headers, sliced out of rb */
+    bhttp_readbuf *rb;
+    bhttp_req_header *headers;
+    int header_count;
+    int header_capacity;
+    /* index + 1 into headers of the first of each bhttp_known_header, 0 if absent */
+    unsigned short known[BHTTP_H_COUNT];
+    /* CLOCK_MONOTONIC ms of the first byte and of the end of the head,
+     * for the server's limits */
+    uint64_t start_ms;
+    uint64_t head_ms;
+    /* end of the last header in rb, body bytes after it are not kept */
+    size_t head_end;
+    unsigned int head_done;
+    /* a header value was folded over several lines (obs-fold) */
+    int folded;
     bhttp_cookie * cookie;
+    /* cookie header split up on first lookup, see bhttp_req_cookie_get */
+    bhttp_req_cookie *cookies;
+    int cookie_count;
+    int cookie_capacity;
+    int cookies_parsed;
+    /* BHTTP_COOKIE_SLOTS of index + 1 into cookies by name hash, 0 for
+     * empty slots. made with the first cookie */
+    unsigned char *cookie_slots;
+    /* query string split up on first lookup, see bhttp_req_param_get */
+    bhttp_req_param *params;
+    int param_count;
+    int param_capacity;
+    /* distinct names in param_slots */
+    int param_names_count;
+    int params_parsed;
+    /* BHTTP_PARAM_SLOTS of index + 1 into params of the first of each
+     * name, 0 for empty slots. made with the first parameter. an int, any
+     * number of parameters may come before a new name */
+    int *param_slots;
+    /* names that had escapes, decoded */
+    char *param_names;
+    size_t param_names_used;
     /* body */
     bstr body;
+    bhttp_body_opts body_opts;
+    /* body bytes received so far */
+    uint64_t body_size;
+    /* content-length of the body, UINT64_MAX for chunked bodies */
+    uint64_t body_expect;
+    /* for splicing uploads, created on first use */
+    int splice_pipe[2];
+    /* set once splicing from the socket failed, the rest is read */
+    int no_splice;
+    /* parser for a multipart body, NULL otherwise */
+    bhttp_multipart *multipart;
+    /* temp file the body was spilled to, -1 while it is in memory */
+    int body_fd;
+    /* response code the request was refused with, 0 if it was not */
+    int reject;
+    /* a 100 Continue is owed, see bhttp_request_continue */
+    int expect_continue;
+    /* for on_body callbacks and handlers, not touched by bittyhttp */
+    void *user_data;
+    /* server the request arrived on, for per-route settings */
+    struct bhttp_server *server;
+    /* handler found once the head is parsed, NULL for none */
+    struct bhttp_handler *handler;
+    /* groups matched by a regex handler */
+    bvec *route_args;
+    /* 404, 405 or 501 when no handler or file will answer, 0 otherwise */
+    int route;
 
     /* parser */
     struct http_parser parser;
-    struct http_parser_settings settings;
     struct http_parser_url parser_url;
+    /* which parser handles this request, a BHTTP_ENGINE_ */
+    int engine;
+    /* content-length body still to come after a fastparse head */
+    uint64_t body_left;
+    /* x of HTTP/1.x */
+    int http_minor;
     /* keep-alive */
     unsigned int keep_alive;
     /* request is done being parsed */
@@ -59,12 +214,65 @@ typedef struct bhttp_request {
 void bhttp_request_init(bhttp_request *request);
 void bhttp_request_free(bhttp_request *request);
 
+/* connection read buffer */
+void bhttp_readbuf_init(bhttp_readbuf *rb);
+void bhttp_readbuf_free(bhttp_readbuf *rb);
+/* makes room for at least len more bytes and returns where they go,
+ * the caller then adds what it wrote to rb->size */
+char *bhttp_readbuf_reserve(bhttp_readbuf *rb, size_t len);
+int bhttp_readbuf_append(bhttp_readbuf *rb, const char *buf, size_t len);
+/* releases the memory of an empty buffer, for idle connections */
+void bhttp_readbuf_shrink(bhttp_readbuf *rb);
+
 /* main functions to read request */
-int receive_data(bhttp_request *request, int sock);
+int receive_data(bhttp_request *request, bhttp_readbuf *rb, int sock);
+/* adds the 100 Continue a client is waiting for to out, once the head is
+ * parsed and the route will take the body. returns 1 if it added one */
+int bhttp_request_continue(bhttp_request *request, struct bhttp_out *out);
+/* parses buffered bytes, stops at the end of the request and leaves
+ * anything after it in rb for the next one. rb must outlive the request
+ * as its headers are read from it */
+int bhttp_request_feed(bhttp_request *request, bhttp_readbuf *rb);
+/* 1 once any of the request has been parsed, before that it holds no
+ * allocations and the connection arena can be reset under it */
+int bhttp_request_started(const bhttp_request *request);
+
+/* fd of a body spilled to a temp file, at offset 0 when the handler runs.
+ * -1 if the body is in req->body. closed when the request is freed */
+int bhttp_req_body_fd(const bhttp_request *req);
+/* size of the body however it was received */
+uint64_t bhttp_req_body_size(const bhttp_request *req);
+
+/* bytes of an upload still to come once nothing is left in the read buffer,
+ * the connection models splice them from the socket instead of reading */
+uint64_t bhttp_request_splice_left(const bhttp_request *request);
+/* splices the upload from sock until it is complete or sock would block */
+int bhttp_request_splice(bhttp_request *request, int sock);
+/* moves n upload bytes the caller spliced into a pipe on to the upload fd */
+void bhttp_request_splice_pipe(bhttp_request *request, int pipe_rd, size_t n);
 
 /* returns a pointer to the value of header_key */
 bhttp_header *bhttp_req_get_header(bhttp_request *req, const char *field);
+/* same for a header the parser recognises, without searching */
+bhttp_header *bhttp_req_get_known_header(bhttp_request *req, bhttp_known_header field);
 /* returns a pointer to a parsed cookie header */
 bhttp_cookie *bhttp_req_get_cookie(bhttp_request *req);
+/* the first cookie called name, NULL if there is none. the cookie header is
+ * only split up once per request and nothing is copied */
+const bhttp_req_cookie *bhttp_req_cookie_get(bhttp_request *req, const char *name);
+/* every cookie in the order they were sent */
+int bhttp_req_cookie_count(bhttp_request *req);
+const bhttp_req_cookie *bhttp_req_cookie_at(bhttp_request *req, int i);
+
+/* the first query parameter called name, NULL if there is none. the query
+ * string is only split up once per request and nothing is copied */
+const bhttp_req_param *bhttp_req_param_get(bhttp_request *req, const char *name);
+/* the next parameter with the same name as p, NULL after the last */
+const bhttp_req_param *bhttp_req_param_next(bhttp_request *req, const bhttp_req_param *p);
+/* every parameter in the order they were sent */
+int bhttp_req_param_count(bhttp_request *req);
+const bhttp_req_param *bhttp_req_param_at(bhttp_request *req, int i);
+/* appends the decoded value of p to dest, returns 0 on success 1 for a bad escape */
+int bhttp_req_param_decode(const bhttp_req_param *p, bstr *dest);
 
 #endif /* BITTYHTTP_REQUEST_H */
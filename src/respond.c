@@ -6,13 +6,16 @@
  *  Copyright (c) 2021 Colin Luoma. All rights reserved.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 
 #include "request.h"
 #include "respond.h"
 #include "header.h"
 #include "http_parser.h"
+#include "arena.h"
 
 void
 bhttp_response_init(bhttp_response *res)
@@ -22,6 +25,49 @@ bhttp_response_init(bhttp_response *res)
     bstr_init(&res->body);
     res->response_code = BHTTP_200_OK;
     res->bodytype = BHTTP_RES_BODY_EMPTY;
+    memset(&res->stream, 0, sizeof res->stream);
+    res->stream_length = 0;
+    memset(&res->borrowed, 0, sizeof res->borrowed);
+    bhttp_out_init(&res->parts, -1, 0, 1);
+    res->parts_length = 0;
+}
+
+static void
+res_stream_close(bhttp_response *res)
+/* gives up a stream that was never handed to the connection */
+{
+    if (res->stream.close != NULL)
+    {
+        int heap = bhttp_arena_heap_only(1);
+        res->stream.close(res->stream.arg);
+        bhttp_arena_heap_only(heap);
+    }
+    memset(&res->stream, 0, sizeof res->stream);
+}
+
+static void
+res_borrow_release(bhttp_response *res)
+/* gives up a borrowed body that was never handed to the connection */
+{
+    if (res->borrowed.release != NULL)
+    {
+        int heap = bhttp_arena_heap_only(1);
+        res->borrowed.release(res->borrowed.arg);
+        bhttp_arena_heap_only(heap);
+    }
+    memset(&res->borrowed, 0, sizeof res->borrowed);
+}
+
+static void
+res_body_clear(bhttp_response *res)
+/* drops whatever body was set before */
+{
+    res_stream_close(res);
+    res_borrow_release(res);
+    bhttp_out_reset(&res->parts);
+    res->parts_length = 0;
+    bstr_free_contents(&res->body);
+    bstr_init(&res->body);
 }
 
 void
@@ -30,6 +76,9 @@ bhttp_response_free(bhttp_response *res)
     bvec_free_contents(&res->headers);
     bhttp_cookie_free(res->cookie);
     bstr_free_contents(&res->body);
+    res_stream_close(res);
+    res_borrow_release(res);
+    bhttp_out_free(&res->parts);
     res->bodytype = BHTTP_RES_BODY_EMPTY;
 }
 
@@ -43,15 +92,18 @@ bhttp_res_add_header(bhttp_response *res, const char *field, const char *value)
     /* first check that field name is valid */
     if (bhttp_header_name_verify(field))
         return 1;
+    /* the response owns it, the connection arena can too */
+    int heap = bhttp_arena_heap_only(0);
     bhttp_header *h = bhttp_header_new();
-    if (h == NULL) return 1;
-    if (bstr_append_cstring_nolen(&(h->field), field) != 0 ||
+    if (h == NULL || bstr_append_cstring_nolen(&(h->field), field) != 0 ||
         bstr_append_cstring_nolen(&(h->value), value) != 0)
     {
-        bhttp_header_free(h);
+        if (h != NULL) bhttp_header_free(h);
+        bhttp_arena_heap_only(heap);
         return 1;
     }
     bvec_add(&res->headers, h);
+    bhttp_arena_heap_only(heap);
     return 0;
 }
 
@@ -82,7 +134,10 @@ bhttp_res_get_all_headers(bhttp_response *res)
 int
 bhttp_res_add_cookie(bhttp_response *res, const char *field, const char *value)
 {
-    return bhttp_cookie_add_entry(res->cookie, field, value);
+    int heap = bhttp_arena_heap_only(0);
+    int r = bhttp_cookie_add_entry(res->cookie, field, value);
+    bhttp_arena_heap_only(heap);
+    return r;
 }
 
 const bvec *
@@ -98,12 +153,11 @@ bhttp_res_get_cookies(bhttp_response *res)
 static int
 bhttp_res_set_body(bhttp_response *res, const char *s, uint64_t len)
 {
-    bstr_free_contents(&res->body);
-    bstr_init(&res->body);
-    if (bstr_append_cstring(&res->body, s, len) == BS_SUCCESS)
-        return 0;
-    else
-        return 1;
+    int heap = bhttp_arena_heap_only(0);
+    res_body_clear(res);
+    int r = bstr_append_cstring(&res->body, s, len) == BS_SUCCESS ? 0 : 1;
+    bhttp_arena_heap_only(heap);
+    return r;
 }
 
 int
@@ -113,6 +167,95 @@ bhttp_res_set_body_text(bhttp_response *res, const char *s)
     return bhttp_res_set_body(res, s, (uint64_t)strlen(s));
 }
 
+int
+bhttp_res_set_body_move(bhttp_response *res, bstr *body)
+{
+    res_body_clear(res);
+    res->body = *body;
+    bstr_init(body);
+    res->bodytype = BHTTP_RES_BODY_TEXT;
+    return 0;
+}
+
+int
+bhttp_res_set_body_move_buf(bhttp_response *res, char *buf, size_t len)
+{
+    if (buf == NULL)
+        return 1;
+    /* only bhttp_malloc memory can go in a bstr, see arena.h */
+    return bhttp_res_set_body_static(res, buf, len, free, buf);
+}
+
+int
+bhttp_res_set_body_static(bhttp_response *res, const char *buf, size_t len,
+                          void (*release)(void *arg), void *arg)
+{
+    if (buf == NULL && len > 0)
+        return 1;
+    res_body_clear(res);
+    res->bodytype = BHTTP_RES_BODY_STATIC;
+    res->borrowed.buf = buf;
+    res->borrowed.len = len;
+    res->borrowed.release = release;
+    res->borrowed.arg = arg;
+    return 0;
+}
+
+static void
+res_parts_start(bhttp_response *res)
+/* the first part replaces any other kind of body */
+{
+    if (res->bodytype != BHTTP_RES_BODY_PARTS)
+    {
+        res_body_clear(res);
+        res->bodytype = BHTTP_RES_BODY_PARTS;
+    }
+}
+
+int
+bhttp_res_add_body_move(bhttp_response *res, bstr *part)
+{
+    res_parts_start(res);
+    size_t len = (size_t)bstr_size(part);
+    int heap = bhttp_arena_heap_only(0);
+    int r = bhttp_out_move(&res->parts, part);
+    bhttp_arena_heap_only(heap);
+    if (r == 0)
+        res->parts_length += len;
+    return r;
+}
+
+int
+bhttp_res_add_body_static(bhttp_response *res, const char *buf, size_t len,
+                          void (*release)(void *arg), void *arg)
+{
+    res_parts_start(res);
+    bhttp_borrow borrow = { buf, len, release, arg };
+    int heap = bhttp_arena_heap_only(0);
+    int r = bhttp_out_borrow(&res->parts, &borrow);
+    bhttp_arena_heap_only(heap);
+    if (r == 0)
+        res->parts_length += len;
+    return r;
+}
+
+int
+bhttp_res_add_body_file(bhttp_response *res, const char *path, uint64_t offset, uint64_t length)
+{
+    /* the length goes out before the file is read, so it has to be there */
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+        offset > (uint64_t)st.st_size || length > (uint64_t)st.st_size - offset)
+        return 1;
+    res_parts_start(res);
+    int heap = bhttp_arena_heap_only(0);
+    int r = bhttp_out_file_range(&res->parts, path, offset, length);
+    bhttp_arena_heap_only(heap);
+    if (r == 0)
+        res->parts_length += length;
+    return r;
+}
+
 int
 bhttp_res_set_body_file(bhttp_response *res, const char *s, int isabs)
 {
@@ -130,6 +273,18 @@ bhttp_res_set_body_file_abs(bhttp_response *res, const char *s)
     return bhttp_res_set_body_file(res, s, 1);
 }
 
+int
+bhttp_res_set_body_stream(bhttp_response *res, const bhttp_stream *stream, uint64_t length)
+{
+    if (stream->read == NULL)
+        return 1;
+    res_body_clear(res);
+    res->bodytype = BHTTP_RES_BODY_STREAM;
+    res->stream = *stream;
+    res->stream_length = length;
+    return 0;
+}
+
 int
 default_file_handler(bhttp_request *req, bhttp_response *res)
 {
@@ -11,13 +11,21 @@
 
 #include <stdio.h>
 #include "cookie.h"
+#include "output.h"
 
 #define BHTTP_RES_CODES C(BHTTP_200_OK, "200 OK")                   \
                         C(BHTTP_204, "204 No Content" )             \
                         C(BHTTP_400, "400 Bad Request")             \
                         C(BHTTP_404, "404 Not Found")               \
+                        C(BHTTP_405, "405 Method Not Allowed")      \
+                        C(BHTTP_408, "408 Request Timeout")         \
+                        C(BHTTP_413, "413 Payload Too Large")       \
+                        C(BHTTP_414, "414 URI Too Long")            \
+                        C(BHTTP_417, "417 Expectation Failed")      \
+                        C(BHTTP_431, "431 Request Header Fields Too Large") \
                         C(BHTTP_500, "500 Internal Server Error")   \
-                        C(BHTTP_501, "501 Not Implemented")
+                        C(BHTTP_501, "501 Not Implemented")         \
+                        C(BHTTP_503, "503 Service Unavailable")
 #define C(k, v) k,
 typedef enum { BHTTP_RES_CODES } bhttp_res_codes;
 #undef C
@@ -26,7 +34,10 @@ typedef enum {
     BHTTP_RES_BODY_EMPTY = 0,
     BHTTP_RES_BODY_TEXT,
     BHTTP_RES_BODY_FILE_REL,
-    BHTTP_RES_BODY_FILE_ABS
+    BHTTP_RES_BODY_FILE_ABS,
+    BHTTP_RES_BODY_STREAM,
+    BHTTP_RES_BODY_STATIC,
+    BHTTP_RES_BODY_PARTS
 } bhttp_response_body_type;
 
 typedef struct bhttp_response {
@@ -38,6 +49,14 @@ typedef struct bhttp_response {
     /* body */
     bhttp_response_body_type bodytype;
     bstr body;
+    /* streamed bodies, see bhttp_res_set_body_stream */
+    bhttp_stream stream;
+    uint64_t stream_length;
+    /* borrowed bodies, see bhttp_res_set_body_static */
+    bhttp_borrow borrowed;
+    /* bodies put together from parts, see bhttp_res_add_body_move */
+    bhttp_out parts;
+    uint64_t parts_length;
 } bhttp_response;
 
 void bhttp_response_init(bhttp_response *res);
@@ -50,8 +69,30 @@ const bvec * bhttp_res_get_all_headers(bhttp_response *res);
 int bhttp_res_add_cookie(bhttp_response *res, const char *field, const char *value);
 const bvec * bhttp_res_get_cookies(bhttp_response *res);
 int bhttp_res_set_body_text(bhttp_response *res, const char *s);
+/* the response takes over the contents of body, which is left empty */
+int bhttp_res_set_body_move(bhttp_response *res, bstr *body);
+/* the response takes over buf, which has to come from malloc */
+int bhttp_res_set_body_move_buf(bhttp_response *res, char *buf, size_t len);
+/* buf is sent as is and must not change until release(arg) is called,
+ * once it is sent or the response is dropped. release may be NULL for
+ * memory that is never freed */
+int bhttp_res_set_body_static(bhttp_response *res, const char *buf, size_t len,
+                              void (*release)(void *arg), void *arg);
 int bhttp_res_set_body_file_rel(bhttp_response *res, const char *s);
 int bhttp_res_set_body_file_abs(bhttp_response *res, const char *s);
+/* the body is pulled from stream while it is sent, and stream.close called
+ * once it is done with. length is its size, or BHTTP_STREAM_NO_LENGTH to
+ * send it with chunked encoding */
+int bhttp_res_set_body_stream(bhttp_response *res, const bhttp_stream *stream, uint64_t length);
+/* a body can also be put together from parts, sent in the order they are
+ * added with one gathered write up to each file. the first part replaces
+ * any other body, and setting one drops the parts. a part that cannot be
+ * added is given up the same as once it is sent */
+int bhttp_res_add_body_move(bhttp_response *res, bstr *part);
+int bhttp_res_add_body_static(bhttp_response *res, const char *buf, size_t len,
+                              void (*release)(void *arg), void *arg);
+/* length bytes of the file at path from offset, which have to be there */
+int bhttp_res_add_body_file(bhttp_response *res, const char *path, uint64_t offset, uint64_t length);
 
 int default_file_handler(bhttp_request *req, bhttp_response *res);
 
@@ -6,10 +6,11 @@
  *  Copyright (c) 2021 Colin Luoma. All rights reserved.
  */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/sendfile.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -22,7 +23,11 @@
 
 #include "server.h"
 #include "respond.h"
+#include "clock.h"
+#include "compress.h"
 #include "http_parser.h"
+#include "reactor.h"
+#include "uring.h"
 #ifdef LUA
 #include "lua_interface.h"
 #endif
@@ -80,11 +85,38 @@ typedef struct bhttp_handler
     /* for lua */
     bstr *lua_file;
     bstr *lua_cb_func;
+    /* request body handling, the server's unless has_body_opts */
+    int has_body_opts;
+    bhttp_body_opts body_opts;
 } bhttp_handler;
 
-#define C(k, v) [k] = (v),
-static const char * bhttp_res_codes_string[] = { BHTTP_RES_CODES };
+/* status line and server header of every response, ready to copy, up to
+ * the value of the date header */
+typedef struct {
+    const char *text;
+    size_t len;
+} status_line;
+
+#define STATUS_LINE(v) "HTTP/1.1 " v "\r\nserver: bittyhttp\r\ndate: "
+#define C(k, v) [k] = { STATUS_LINE(v), sizeof(STATUS_LINE(v)) - 1 },
+static const status_line status_lines[] = { BHTTP_RES_CODES };
 #undef C
+#undef STATUS_LINE
+
+/* what a response adds to the handler's headers */
+typedef struct {
+    /* "keep-alive", "close", or NULL to leave it out */
+    const char *connection;
+    /* content-length, BHTTP_STREAM_NO_LENGTH to leave it out */
+    uint64_t length;
+    int chunked;
+    /* content-type unless the handler set one, may be NULL */
+    const char *type;
+    /* content-encoding, NULL for none */
+    const char *encoding;
+    /* the body depends on accept-encoding */
+    int vary;
+} head_fields;
 
 /* TODO: handle HEAD requests properly */
 
@@ -95,6 +127,7 @@ bhttp_handler_new(int bhttp_handler_type, const char * uri, int (*cb)())
     if (handler == NULL) return NULL;
     handler->lua_file = NULL;
     handler->lua_cb_func = NULL;
+    handler->has_body_opts = 0;
 
     bstr_init(&handler->match);
     if (bstr_append_cstring_nolen(&handler->match, uri) != BS_SUCCESS)
@@ -168,6 +201,25 @@ bhttp_add_regex_handler(bhttp_server *server, uint32_t methods, const char *uri,
     return 0;
 }
 
+int
+bhttp_handler_set_body_opts(bhttp_server *server, const char *uri, const bhttp_body_opts *opts)
+/* returns 1 if no handler was added with uri */
+{
+    int r = 1;
+    WRITE_LOCK(server);
+    for (int i = 0; i < bvec_count(&server->handlers); i++)
+    {
+        bhttp_handler *h = bvec_get(&server->handlers, i);
+        if (strcmp(bstr_cstring(&h->match), uri) != 0)
+            continue;
+        h->has_body_opts = 1;
+        h->body_opts = *opts;
+        r = 0;
+    }
+    UNLOCK(server);
+    return r;
+}
+
 #ifdef LUA
 int
 bhttp_add_lua_handler(bhttp_server *server, uint32_t methods, const char *uri,
@@ -202,7 +254,26 @@ bhttp_server_new()
     server->default_file = strdup("index.html");
     server->backlog = 10;
     server->use_sendfile = 1;
+    server->io_model = BHTTP_IO_THREADS;
+    server->pool_workers = 0;
+    server->pool_queue_depth = 128;
+    server->pool_policy = BHTTP_POOL_BLOCK;
+    server->shards = 1;
+    server->arena_size = BHTTP_ARENA_BLOCK_SIZE;
+    server->requests = 0;
+    memset(&server->body_opts, 0, sizeof server->body_opts);
+    server->limits.head_timeout = 20;
+    server->limits.max_head_size = 64 * 1024;
+    server->limits.max_headers = 100;
+    server->limits.max_uri = 8192;
+    server->limits.min_rate = 0;
+    /* off until asked for */
+    server->compress.level = 0;
+    server->compress.min_size = 1024;
+    memset(&server->limit_stats, 0, sizeof server->limit_stats);
     server->sock = 0;
+    server->shard = NULL;
+    server->shard_count = 0;
     bvec_init(&server->handlers, (void (*)(void *)) bhttp_handler_free);
 
     if (server->port == NULL || server->docroot == NULL ||
@@ -218,10 +289,26 @@ bhttp_server_new()
         return NULL;
     }
     server->state = BHTTP_SERVER_STATE_OFF;
+    server->stopping = 0;
 
     return server;
 }
 
+static void
+free_shards(bhttp_server *server)
+/* closes every listener and stops its worker pool */
+{
+    for (int i = 0; i < server->shard_count; i++)
+    {
+        bhttp_shard *shard = &server->shard[i];
+        if (shard->pool != NULL) bhttp_pool_free(shard->pool);
+        if (shard->sock >= 0) close(shard->sock);
+    }
+    free(server->shard);
+    server->shard = NULL;
+    server->shard_count = 0;
+}
+
 void
 bhttp_server_free(bhttp_server *server)
 {
@@ -230,6 +317,7 @@ bhttp_server_free(bhttp_server *server)
     if (server->docroot != NULL) free(server->docroot);
     if (server->log_file != NULL) free(server->log_file);
     if (server->default_file != NULL) free(server->default_file);
+    if (server->shard != NULL) free_shards(server);
     bvec_free_contents(&server->handlers);
     pthread_rwlock_destroy(&server->rwlock);
     free(server);
@@ -354,10 +442,255 @@ exit:
 }
 
 int
-bhttp_server_bind(bhttp_server *server)
+bhttp_server_set_io_model(bhttp_server *server, bhttp_io_model model)
+/* selects how connections are served: a thread each, an epoll reactor or io_uring */
+{
+    /* return value, default 0=success, 1=failure */
+    int r = 0;
+
+    READ_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set io model in current state\n");
+        r = 1;
+        goto exit;
+    }
+    UNLOCK(server);
+
+    WRITE_LOCK(server);
+#ifndef URING
+    if (model == BHTTP_IO_URING)
+    {
+        fprintf(stderr, "bhttp: io_uring support was not built in, use `make URING=1`\n");
+        r = 1;
+        goto exit;
+    }
+#endif
+    if (model != BHTTP_IO_THREADS && model != BHTTP_IO_EPOLL && model != BHTTP_IO_URING)
+        r = 1;
+    else
+        server->io_model = model;
+exit:
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_set_pool(bhttp_server *server, int workers, int queue_depth, bhttp_pool_policy policy)
+/* serve connections from a fixed set of worker threads instead of a new thread each */
+{
+    /* return value, default 0=success, 1=failure */
+    int r = 0;
+
+    READ_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set worker pool in current state\n");
+        r = 1;
+        goto exit;
+    }
+    UNLOCK(server);
+
+    WRITE_LOCK(server);
+    if (workers < 0 || queue_depth <= 0 ||
+        (policy != BHTTP_POOL_BLOCK && policy != BHTTP_POOL_SHED && policy != BHTTP_POOL_CLOSE))
+    {
+        r = 1;
+        goto exit;
+    }
+    server->pool_workers = workers;
+    server->pool_queue_depth = queue_depth;
+    server->pool_policy = policy;
+exit:
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_get_pool_stats(bhttp_server *server, bhttp_pool_stats *stats)
+/* sums the pools of every shard, returns 1 if the server is not running with a worker pool */
+{
+    int r = 1;
+    memset(stats, 0, sizeof(bhttp_pool_stats));
+    READ_LOCK(server);
+    for (int i = 0; i < server->shard_count; i++)
+    {
+        if (server->shard[i].pool == NULL)
+            continue;
+        bhttp_pool_stats s;
+        bhttp_pool_get_stats(server->shard[i].pool, &s);
+        stats->workers += s.workers;
+        stats->queue_capacity += s.queue_capacity;
+        stats->queue_depth += s.queue_depth;
+        stats->queued += s.queued;
+        stats->rejected += s.rejected;
+        stats->wait_ns_total += s.wait_ns_total;
+        if (s.wait_ns_max > stats->wait_ns_max)
+            stats->wait_ns_max = s.wait_ns_max;
+        r = 0;
+    }
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_set_shards(bhttp_server *server, int shards)
+/* open this many SO_REUSEPORT listeners, each served by its own acceptor pinned to a cpu
+ * BHTTP_SHARDS_PER_CPU opens one per online cpu */
+{
+    /* return value, default 0=success, 1=failure */
+    int r = 0;
+
+    READ_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set shards in current state\n");
+        r = 1;
+        goto exit;
+    }
+    UNLOCK(server);
+
+    WRITE_LOCK(server);
+    if (shards < 0)
+        r = 1;
+    else
+        server->shards = shards;
+exit:
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_get_shard_count(bhttp_server *server)
+{
+    READ_LOCK(server);
+    int n = server->shard_count;
+    UNLOCK(server);
+    return n;
+}
+
+uint64_t
+bhttp_server_get_shard_accepts(bhttp_server *server, int shard)
+/* number of connections accepted so far on the given listener */
+{
+    uint64_t n = 0;
+    READ_LOCK(server);
+    if (shard >= 0 && shard < server->shard_count)
+        n = __atomic_load_n(&server->shard[shard].accepts, __ATOMIC_RELAXED);
+    UNLOCK(server);
+    return n;
+}
+
+int
+bhttp_server_set_arena_size(bhttp_server *server, size_t block_size)
+/* block size of the arena each connection allocates its requests from, 0 uses the heap */
+{
+    /* return value, default 0=success, 1=failure */
+    int r = 0;
+
+    READ_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set arena size in current state\n");
+        r = 1;
+        goto exit;
+    }
+    UNLOCK(server);
+
+    WRITE_LOCK(server);
+    if (block_size > 0 && block_size < 1024)
+        r = 1;
+    else
+        server->arena_size = block_size;
+exit:
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_set_body_opts(bhttp_server *server, const bhttp_body_opts *opts)
+/* body limits, spilling and streaming for every route without its own */
+{
+    WRITE_LOCK(server);
+    server->body_opts = *opts;
+    UNLOCK(server);
+    return 0;
+}
+
+void
+bhttp_server_get_alloc_stats(bhttp_server *server, bhttp_alloc_stats *stats)
+/* allocation counters of the process with the requests this server answered,
+ * heap / requests is the malloc calls per request */
+{
+    bhttp_alloc_get_stats(stats);
+    stats->requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+}
+
+int
+bhttp_server_set_limits(bhttp_server *server, const bhttp_limits *limits)
+/* header read budgets and the slowest body accepted, read without locking
+ * by every connection so only before the server starts */
+{
+    int r = 0;
+    WRITE_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set limits in current state\n");
+        r = 1;
+    }
+    else
+        server->limits = *limits;
+    UNLOCK(server);
+    return r;
+}
+
+int
+bhttp_server_set_compression(bhttp_server *server, const bhttp_compress_opts *opts)
+/* read without locking while responses are written, so only before the
+ * server starts */
+{
+    int r = 0;
+    WRITE_LOCK(server);
+    if (server->state != BHTTP_SERVER_STATE_OFF)
+    {
+        fprintf(stderr, "bhttp: Cannot set compression in current state\n");
+        r = 1;
+    }
+    else if (opts->level < 0 || opts->level > 9)
+    {
+        fprintf(stderr, "bhttp: Compression level must be 0 to 9\n");
+        r = 1;
+    }
+    else if (opts->level > 0 && !bhttp_compress_available())
+    {
+        fprintf(stderr, "bhttp: zlib support was not built in, use `make ZLIB=1`\n");
+        r = 1;
+    }
+    else
+        server->compress = *opts;
+    UNLOCK(server);
+    return r;
+}
+
+void
+bhttp_server_get_limit_stats(bhttp_server *server, bhttp_limit_stats *stats)
+/* requests refused for each limit so far */
+{
+    stats->head_timeouts = __atomic_load_n(&server->limit_stats.head_timeouts, __ATOMIC_RELAXED);
+    stats->slow_bodies = __atomic_load_n(&server->limit_stats.slow_bodies, __ATOMIC_RELAXED);
+    stats->heads_too_large = __atomic_load_n(&server->limit_stats.heads_too_large, __ATOMIC_RELAXED);
+    stats->too_many_headers = __atomic_load_n(&server->limit_stats.too_many_headers, __ATOMIC_RELAXED);
+    stats->uris_too_long = __atomic_load_n(&server->limit_stats.uris_too_long, __ATOMIC_RELAXED);
+    stats->bodies_too_large = __atomic_load_n(&server->limit_stats.bodies_too_large, __ATOMIC_RELAXED);
+}
+
+static int
+bind_listener(bhttp_server *server, int reuseport)
+/* returns a socket listening on the server ip and port, -1 on failure */
 {
     struct addrinfo hints = {0};
     struct addrinfo *servinfo, *p;
+    int sock = -1;
 
     /* ipv4 or 6 */
     hints.ai_family = AF_UNSPEC;
@@ -369,23 +702,24 @@ bhttp_server_bind(bhttp_server *server)
     int r;
     if ((r = getaddrinfo(server->ip, server->port, &hints, &servinfo)) != 0) {
         fprintf(stderr, "error getting addrinfo: %s\n", gai_strerror(r));
-        return 1;
+        return -1;
     }
 
     /* try to find a socket to bind to */
     for(p = servinfo; p != NULL; p = p->ai_next) {
-        if ((server->sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+        if ((sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
             perror("error creating socket");
             continue;
         }
         int turnon = 1;
-        if (setsockopt(server->sock, SOL_SOCKET, SO_REUSEADDR, &turnon, sizeof(int)) == -1) {
-            close(server->sock);
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &turnon, sizeof(int)) == -1 ||
+            (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &turnon, sizeof(int)) == -1)) {
+            close(sock);
             freeaddrinfo(servinfo);
-            return 1;
+            return -1;
         }
-        if (bind(server->sock, p->ai_addr, p->ai_addrlen) == -1) {
-            close(server->sock);
+        if (bind(sock, p->ai_addr, p->ai_addrlen) == -1) {
+            close(sock);
             perror("error binding socket");
             continue;
         }
@@ -393,10 +727,66 @@ bhttp_server_bind(bhttp_server *server)
     }
     freeaddrinfo(servinfo);
 
-    if (p == NULL || listen(server->sock, server->backlog) == -1)  {
+    if (p == NULL || listen(sock, server->backlog) == -1)  {
         perror("failed to start server");
+        if (p != NULL) close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int
+nth_cpu(const cpu_set_t *set, int n)
+/* the cpu number of the nth cpu in set, counting from 0 */
+{
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, set) && n-- == 0)
+            return cpu;
+    return -1;
+}
+
+int
+bhttp_server_bind(bhttp_server *server)
+/* opens the listener of every shard */
+{
+    /* under taskset or a cpuset the process may run on fewer cpus than are
+     * online, pinning to any other cpu would fail */
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    int ncpu = 0;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == 0)
+        ncpu = CPU_COUNT(&allowed);
+    /* without a mask to go by, shards are left unpinned */
+    int pin = ncpu > 0;
+    if (!pin)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        ncpu = online < 1 ? 1 : (int)online;
+    }
+    int n = server->shards == BHTTP_SHARDS_PER_CPU ? ncpu : server->shards;
+
+    server->shard = calloc((size_t)n, sizeof(bhttp_shard));
+    if (server->shard == NULL)
         return 1;
+    server->shard_count = n;
+    for (int i = 0; i < n; i++)
+        server->shard[i].sock = -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        bhttp_shard *shard = &server->shard[i];
+        shard->server = server;
+        shard->index = i;
+        /* a single listener is left wherever the scheduler puts it */
+        shard->cpu = n > 1 && pin ? nth_cpu(&allowed, i % ncpu) : -1;
+        if ((shard->sock = bind_listener(server, n > 1)) == -1)
+        {
+            free_shards(server);
+            return 1;
+        }
     }
+    server->sock = server->shard[0].sock;
 
     return 0;
 }
@@ -464,7 +854,7 @@ clean_filepath(bstr *dest, const bstr *path)
     char *start, *slash, *out;
 
     walk  = bstr_cstring(path);
-    start = calloc(bstr_size(path)+1, 1);
+    start = bhttp_calloc(bstr_size(path)+1, 1);
     if (start == NULL)
         return 1;
     out   = start;
@@ -524,198 +914,323 @@ clean_filepath(bstr *dest, const bstr *path)
         }
     }
     r = bstr_append_cstring(dest, start, out - start);
-    free(start);
+    bhttp_free(start);
     if (r != BS_SUCCESS)
         return 1;
     else
         return 0;
 }
 
-static int
-send_buffer(int sock, const char *buf, size_t len)
+static size_t
+u64_to_ascii(uint64_t v, char *dest)
+/* dest needs room for 20 digits, returns how many were written */
 {
-    /* send buffer data */
-    ssize_t sent = send(sock, buf, len, MSG_NOSIGNAL);
-    if ( sent < 0 ) return 1;
-    if (sent < len) return 1;
-    return 0;
+    char tmp[20];
+    char *p = tmp + sizeof tmp;
+    do
+    {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    size_t n = (size_t)(tmp + sizeof tmp - p);
+    memcpy(dest, p, n);
+    return n;
 }
 
+#define PUT(p, s, n) (memcpy((p), (s), (n)), (p) + (n))
+#define PUT_LIT(p, s) PUT(p, s, sizeof(s) - 1)
+
 static int
-send_headers(int sock, bhttp_response *res)
-/* includes the final /r/n after the header block */
+send_headers(bhttp_out *out, bhttp_response *res, const head_fields *hf)
+/* includes the final /r/n after the header block. it is sized first and
+ * built on the stack, or on the heap in the rare case it does not fit */
 {
-    int r;
-    bstr *header_text = bstr_new();
-    if (header_text == NULL) return 1;
-
+    int code = res->response_code;
+    if (code < 0 || code >= (int)(sizeof status_lines / sizeof status_lines[0]))
+        code = BHTTP_500;
+    const status_line *status = &status_lines[code];
     const bvec *headers = bhttp_res_get_all_headers(res);
-    bstr_append_printf(header_text, "HTTP/1.1 %s\r\n", bhttp_res_codes_string[res->response_code]);
+    const bvec *cookies = bhttp_res_get_cookies(res);
+    const char *type = hf->type;
+    if (type != NULL && bhttp_res_get_header(res, "content-type") != NULL)
+        type = NULL;
+
+    /* the date, its \r\n and the one ending the block */
+    size_t size = status->len + BHTTP_DATE_LEN + 4;
     for (int i = 0; i < bvec_count(headers); i++)
     {
         bhttp_header *h = bvec_get(headers, i);
-        bstr_append_cstring(header_text, bstr_cstring(&h->field), bstr_size(&h->field));
-        bstr_append_cstring(header_text, bstr_const_str(": "));
-        bstr_append_cstring(header_text, bstr_cstring(&h->value), bstr_size(&h->value));
-        bstr_append_cstring(header_text, bstr_const_str("\r\n"));
+        size += (size_t)bstr_size(&h->field) + (size_t)bstr_size(&h->value) + 4;
     }
-
-    /* add cookies */
-    const bvec *cookies = bhttp_res_get_cookies(res);
     for (int i = 0; i < bvec_count(cookies); i++)
     {
-        bstr_append_cstring(header_text, bstr_const_str("set-cookie: "));
         bhttp_cookie_entry *ce = bvec_get(cookies, i);
-        bstr_append_cstring(header_text, bstr_cstring(&ce->field), bstr_size(&ce->field));
-        bstr_append_cstring(header_text, bstr_const_str("="));
-        bstr_append_cstring(header_text, bstr_cstring(&ce->value), bstr_size(&ce->value));
-        /* TODO: add support here for max-age, etc. */
-        bstr_append_cstring(header_text, bstr_const_str("\r\n"));
+        size += sizeof("set-cookie: =\r\n") - 1 +
+                (size_t)bstr_size(&ce->field) + (size_t)bstr_size(&ce->value);
     }
+    if (hf->connection != NULL)
+        size += sizeof("connection: \r\n") - 1 + strlen(hf->connection);
+    if (type != NULL)
+        size += sizeof("content-type: \r\n") - 1 + strlen(type);
+    if (hf->encoding != NULL)
+        size += sizeof("content-encoding: \r\n") - 1 + strlen(hf->encoding);
+    if (hf->vary)
+        size += sizeof("vary: accept-encoding\r\n") - 1;
+    if (hf->chunked)
+        size += sizeof("transfer-encoding: chunked\r\n") - 1;
+    if (hf->length != BHTTP_STREAM_NO_LENGTH)
+        size += sizeof("content-length: \r\n") - 1 + 20;
+
+    char head[BHTTP_OUT_HEAD];
+    char *buf = head;
+    if (size > sizeof head && (buf = bhttp_malloc(size)) == NULL)
+        return 1;
 
-    bstr_append_cstring(header_text, bstr_const_str("\r\n"));
+    char *p = PUT(buf, status->text, status->len);
+    bhttp_clock_date(p);
+    p = PUT_LIT(p + BHTTP_DATE_LEN, "\r\n");
+    if (hf->connection != NULL)
+    {
+        p = PUT_LIT(p, "connection: ");
+        p = PUT(p, hf->connection, strlen(hf->connection));
+        p = PUT_LIT(p, "\r\n");
+    }
+    for (int i = 0; i < bvec_count(headers); i++)
+    {
+        bhttp_header *h = bvec_get(headers, i);
+        p = PUT(p, bstr_cstring(&h->field), (size_t)bstr_size(&h->field));
+        p = PUT_LIT(p, ": ");
+        p = PUT(p, bstr_cstring(&h->value), (size_t)bstr_size(&h->value));
+        p = PUT_LIT(p, "\r\n");
+    }
+    if (type != NULL)
+    {
+        p = PUT_LIT(p, "content-type: ");
+        p = PUT(p, type, strlen(type));
+        p = PUT_LIT(p, "\r\n");
+    }
+    if (hf->encoding != NULL)
+    {
+        p = PUT_LIT(p, "content-encoding: ");
+        p = PUT(p, hf->encoding, strlen(hf->encoding));
+        p = PUT_LIT(p, "\r\n");
+    }
+    if (hf->vary)
+        p = PUT_LIT(p, "vary: accept-encoding\r\n");
+    if (hf->chunked)
+        p = PUT_LIT(p, "transfer-encoding: chunked\r\n");
+    if (hf->length != BHTTP_STREAM_NO_LENGTH)
+    {
+        p = PUT_LIT(p, "content-length: ");
+        p += u64_to_ascii(hf->length, p);
+        p = PUT_LIT(p, "\r\n");
+    }
+    /* TODO: add support here for max-age, etc. */
+    for (int i = 0; i < bvec_count(cookies); i++)
+    {
+        bhttp_cookie_entry *ce = bvec_get(cookies, i);
+        p = PUT_LIT(p, "set-cookie: ");
+        p = PUT(p, bstr_cstring(&ce->field), (size_t)bstr_size(&ce->field));
+        p = PUT_LIT(p, "=");
+        p = PUT(p, bstr_cstring(&ce->value), (size_t)bstr_size(&ce->value));
+        p = PUT_LIT(p, "\r\n");
+    }
+    p = PUT_LIT(p, "\r\n");
 
-    r = send_buffer(sock, bstr_cstring(header_text), (size_t)bstr_size(header_text));
-    bstr_free(header_text);
+    int r = bhttp_out_buffer(out, buf, (size_t)(p - buf));
+    if (buf != head)
+        bhttp_free(buf);
     if (r != 0)
         return 1;
     return 0;
 }
 
-static int
-send_file(int sock, const char *file_path, size_t file_size, int use_sendfile)
-/* makes sure the send an entire file to sock */
+#undef PUT_LIT
+#undef PUT
+
+static void
+send_empty_response(bhttp_out *out, bhttp_response *res, int code, const char *connection)
 {
-    ssize_t sent = 0;
-    if (use_sendfile)
-    {
-        int f = open(file_path, O_RDONLY);
-        if ( f <= 0 )
-        {
-            fprintf(stderr, "Cannot open file %d\n", errno);
-            return 1;
-        }
-        off_t len = 0;
-        ssize_t ret;
-        while ((ret = sendfile(sock, f, &len, file_size-sent)) > 0)
-        {
-            sent += ret;
-            if (sent >= (ssize_t)file_size) break;
-        }
-        close(f);
-        if (ret == -1)
-        {
-            perror("sendfile error");
-            return 1;
-        }
-    }
-    else
-    {
-        FILE *f = fopen(file_path, "rb");
-        if ( f == NULL )
-        {
-            fprintf(stderr, "Cannot open file %d\n", errno);
-            return 1;
-        }
-        size_t len;
-        char buf[SEND_BUFFER_SIZE];
-        int bad = 0;
-        while ((len = fread(buf, 1, SEND_BUFFER_SIZE, f)) > 0)
-        {
-            if (len < SEND_BUFFER_SIZE)
-            {
-                /* check error or end-of-file */
-                if (ferror(f))
-                {
-                    perror("fread error");
-                    bad = 1;
-                    break;
-                }
-                else if (feof(f)) {}
-            }
-            sent = 0;
-            ssize_t ret;
-            while ((ret = send(sock, buf+sent, len-sent, MSG_NOSIGNAL)) > 0)
-            {
-                sent += ret;
-                if (sent >= (ssize_t)file_size) break;
-            }
-            if (ret == -1)
-            {
-                perror("send error");
-                bad = 1;
-                break;
-            }
-        }
-        fclose(f);
-        if (bad) return 1;
-    }
-    return 0;
+    res->response_code = code;
+    head_fields hf = { connection, 0, 0, NULL, NULL, 0 };
+    send_headers(out, res, &hf);
 }
 
 static void
-send_500_response(int sock, bhttp_response *res)
+send_500_response(bhttp_out *out, bhttp_response *res)
 {
-    res->response_code = BHTTP_500;
-    /* send header */
-    bhttp_res_add_header(res, "server", "bittyhttp");
-    bhttp_res_add_header(res, "content-length", "0");
-    send_headers(sock, res);
+    send_empty_response(out, res, BHTTP_500, NULL);
 }
 static void
-send_501_response(int sock, bhttp_response *res)
+send_405_response(bhttp_out *out, bhttp_response *res)
 {
-    res->response_code = BHTTP_501;
-    /* send header */
-    bhttp_res_add_header(res, "server", "bittyhttp");
-    bhttp_res_add_header(res, "content-length", "0");
-    send_headers(sock, res);
+    send_empty_response(out, res, BHTTP_405, NULL);
+}
+static void
+send_501_response(bhttp_out *out, bhttp_response *res)
+{
+    send_empty_response(out, res, BHTTP_501, NULL);
+}
+
+static void
+send_503_response(bhttp_out *out, bhttp_response *res)
+{
+    send_empty_response(out, res, BHTTP_503, "close");
+}
+
+static void
+send_reject_response(bhttp_out *out, bhttp_response *res, int code)
+/* answers a request refused while it was read, the connection is closed after */
+{
+    send_empty_response(out, res, code, "close");
 }
 
 static void
-send_404_response(int sock, bhttp_response *res)
+send_404_response(bhttp_out *out, bhttp_response *res, const char *connection)
 {
-    /* add our own headers and set 404 message */
+    /* set our own 404 message */
     res->response_code = BHTTP_404;
     bhttp_res_set_body_text(res, "<html><p>bittyhttp: 404 - NOT FOUND</p></html>");
-    bhttp_res_add_header(res, "content-type", "text/html");
-    bstr tmp; bstr_init(&tmp); bstr_append_printf(&tmp, "%d", bstr_size(&res->body));
-    bhttp_res_add_header(res, "content-length", bstr_cstring(&tmp));
-    bstr_free_contents(&tmp);
+    head_fields hf = { connection, (uint64_t)bstr_size(&res->body), 0, "text/html", NULL, 0 };
 
     /* send header */
-    send_headers(sock, res);
+    send_headers(out, res, &hf);
     /* send body */
-    send_buffer(sock, bstr_cstring(&res->body), (size_t)bstr_size(&res->body));
+    bhttp_out_move(out, &res->body);
+}
+
+static void
+compress_body(bhttp_server *server, bhttp_request *req, bhttp_response *res, head_fields *hf)
+/* swaps a body built in memory for its gzip or deflate form, when the
+ * client takes one and it comes out smaller. files and streams go as is */
+{
+    uint64_t len;
+    if (res->bodytype == BHTTP_RES_BODY_TEXT)
+        len = bstr_size(&res->body);
+    else if (res->bodytype == BHTTP_RES_BODY_STATIC)
+        len = res->borrowed.len;
+    else if (res->bodytype == BHTTP_RES_BODY_PARTS)
+        len = res->parts_length;
+    else
+        return;
+    if (len < server->compress.min_size)
+        return;
+    /* the handler encoded it itself */
+    if (bhttp_res_get_header(res, "content-encoding") != NULL)
+        return;
+    const bhttp_header *h = bhttp_res_get_header(res, "content-type");
+    if (mime_is_compressed(h != NULL ? bstr_cstring(&h->value) : "text/plain"))
+        return;
+
+    struct iovec one;
+    struct iovec *iov = &one;
+    int count = 1;
+    if (res->bodytype == BHTTP_RES_BODY_TEXT)
+    {
+        one.iov_base = (void *)bstr_cstring(&res->body);
+        one.iov_len = (size_t)len;
+    }
+    else if (res->bodytype == BHTTP_RES_BODY_STATIC)
+    {
+        one.iov_base = (void *)res->borrowed.buf;
+        one.iov_len = res->borrowed.len;
+    }
+    else
+    {
+        count = bvec_count(&res->parts.segs);
+        if ((iov = bhttp_malloc(sizeof(struct iovec) * (size_t)count)) == NULL)
+            return;
+        for (int i = 0; i < count; i++)
+        {
+            bhttp_out_seg *seg = bvec_get(&res->parts.segs, i);
+            /* file parts are sent with sendfile, never read in here */
+            if (seg->type != BHTTP_OUT_BUF)
+            {
+                bhttp_free(iov);
+                return;
+            }
+            iov[i].iov_base = (void *)seg->bytes;
+            iov[i].iov_len = (size_t)seg->size;
+        }
+    }
+
+    /* caches have to keep a copy per coding from here on */
+    hf->vary = 1;
+    bhttp_encoding enc = BHTTP_ENC_IDENTITY;
+    /* read in place, building the header would allocate for every response */
+    unsigned short ae = req->known[BHTTP_H_ACCEPT_ENCODING];
+    if (ae != 0)
+    {
+        const bhttp_req_header *rh = &req->headers[ae - 1];
+        enc = bhttp_compress_negotiate(req->rb->data + rh->value_off, rh->value_len);
+    }
+    bstr z;
+    bstr_init(&z);
+    if (enc != BHTTP_ENC_IDENTITY &&
+        bhttp_compress(enc, server->compress.level, iov, count, &z) == 0)
+    {
+        bhttp_res_set_body_move(res, &z);
+        hf->encoding = bhttp_encoding_name(enc);
+    }
+    if (iov != &one)
+        bhttp_free(iov);
 }
 
 static void
-write_response(bhttp_server *server, bhttp_response *res, bhttp_request *req, int sock)
+write_response(bhttp_server *server, bhttp_response *res, bhttp_request *req, bhttp_out *out)
 {
-    bhttp_res_add_header(res, "server", "bittyhttp");
+    /* an HTTP/1.0 client only sees the end of a body without a length when
+     * the connection closes */
+    if (res->bodytype == BHTTP_RES_BODY_STREAM && res->stream_length == BHTTP_STREAM_NO_LENGTH &&
+        req->http_minor == 0)
+        req->keep_alive = BHTTP_CLOSE;
+    head_fields hf = { NULL, 0, 0, NULL, NULL, 0 };
     if (req->keep_alive == BHTTP_KEEP_ALIVE)
-        bhttp_res_add_header(res, "connection", "keep-alive");
+        hf.connection = "keep-alive";
+    if (server->compress.level > 0)
+        compress_body(server, req, res, &hf);
 
     if (res->bodytype == BHTTP_RES_BODY_EMPTY)
     {
         /* send full HTTP response header */
-        bhttp_res_add_header(res, "content-length", "0");
-        send_headers(sock, res);
+        send_headers(out, res, &hf);
     }
     else if (res->bodytype == BHTTP_RES_BODY_TEXT)
     {
-        /* check 'content-type', add default if missing */
-        const bhttp_header *h = bhttp_res_get_header(res, "content-type");
-        if (h == NULL)
-            bhttp_res_add_header(res, "content-type", "text/plain");
-        /* add 'content-length' based on text in body */
-        bstr tmp; bstr_init(&tmp); bstr_append_printf(&tmp, "%d", bstr_size(&res->body));
-        bhttp_res_add_header(res, "content-length", bstr_cstring(&tmp));
-        bstr_free_contents(&tmp);
+        /* 'content-type' defaults to text, 'content-length' is the body's */
+        hf.type = "text/plain";
+        hf.length = (uint64_t)bstr_size(&res->body);
         /* send full HTTP response header */
-        send_headers(sock, res);
-        /* send body */
-        send_buffer(sock, bstr_cstring(&res->body), (size_t)bstr_size(&res->body));
+        send_headers(out, res, &hf);
+        /* send body, the connection takes it over rather than copy it */
+        bhttp_out_move(out, &res->body);
+    }
+    else if (res->bodytype == BHTTP_RES_BODY_STATIC)
+    {
+        hf.type = "text/plain";
+        hf.length = (uint64_t)res->borrowed.len;
+        send_headers(out, res, &hf);
+        /* released by the connection once it is sent */
+        bhttp_out_borrow(out, &res->borrowed);
+        memset(&res->borrowed, 0, sizeof res->borrowed);
+    }
+    else if (res->bodytype == BHTTP_RES_BODY_PARTS)
+    {
+        hf.type = "text/plain";
+        hf.length = res->parts_length;
+        send_headers(out, res, &hf);
+        /* the parts join the connection's queue as they are */
+        bhttp_out_append(out, &res->parts);
+    }
+    else if (res->bodytype == BHTTP_RES_BODY_STREAM)
+    {
+        hf.type = "application/octet-stream";
+        hf.length = res->stream_length;
+        hf.chunked = res->stream_length == BHTTP_STREAM_NO_LENGTH && req->http_minor > 0;
+        send_headers(out, res, &hf);
+        /* the connection owns the stream from here */
+        bhttp_out_stream(out, &res->stream, res->stream_length, hf.chunked);
+        memset(&res->stream, 0, sizeof res->stream);
     }
     else if (res->bodytype == BHTTP_RES_BODY_FILE_REL ||
              res->bodytype == BHTTP_RES_BODY_FILE_ABS)
@@ -742,19 +1257,17 @@ write_response(bhttp_server *server, bhttp_response *res, bhttp_request *req, in
         if (fs.found && !fs.isdir)
         {
             /* add our own headers */
-            bhttp_res_add_header(res, "content-type", mime_from_ext(fs.extension));
-            bstr tmp; bstr_init(&tmp); bstr_append_printf(&tmp, "%d", fs.bytes);
-            bhttp_res_add_header(res, "content-length", bstr_cstring(&tmp));
-            bstr_free_contents(&tmp);
+            hf.type = mime_from_ext(fs.extension);
+            hf.length = (uint64_t)fs.bytes;
 
             /* send header */
-            send_headers(sock, res);
+            send_headers(out, res, &hf);
             /* send file contents */
-            send_file(sock, bstr_cstring(file_path), fs.bytes, server->use_sendfile);
+            bhttp_out_file(out, bstr_cstring(file_path), (uint64_t)fs.bytes);
         }
         else
         {
-            send_404_response(sock, res);
+            send_404_response(out, res, hf.connection);
         }
         bstr_free(file_path);
     }
@@ -770,7 +1283,7 @@ regex_match_handler(bhttp_handler *handler, bstr *uri_path)
     /* no matches or error in regexec */
     if (r) return NULL;
 
-    bvec *matched_parts = malloc(sizeof(bvec));
+    bvec *matched_parts = bhttp_malloc(sizeof(bvec));
     if (matched_parts == NULL) return NULL;
 
     bvec_init(matched_parts, (void (*)(void *)) bstr_free);
@@ -788,80 +1301,209 @@ regex_match_handler(bhttp_handler *handler, bstr *uri_path)
 }
 
 static int
-match_handler(bhttp_server *server, bhttp_request *req, bhttp_response *res)
+handler_matches_path(bhttp_handler *handler, bhttp_request *req)
+{
+    if (handler->type == BHTTP_HANDLER_REGEX)
+        return regexec(&handler->regex_buf, bstr_cstring(&req->uri_path), 0, NULL, 0) == 0;
+    return strcmp(bstr_cstring(&handler->match), bstr_cstring(&req->uri_path)) == 0;
+}
+
+void
+bhttp_server_route(bhttp_server *server, bhttp_request *req)
 {
-    /* return value from handlers */
-    int r;
-    /* TODO: should actually try and return 405 for matched paths */
-    /* match handlers here */
     READ_LOCK(server);
-    for (int i = 0; i < bvec_count(&server->handlers); i++)
+    req->body_opts = server->body_opts;
+    /* unmatched GET and HEAD requests still try the docroot */
+    req->route = req->method == BHTTP_UNSUPPORTED_METHOD ? BHTTP_501 :
+                 req->method & (BHTTP_GET | BHTTP_HEAD) ? 0 : BHTTP_404;
+    for (int i = 0; req->route != BHTTP_501 && i < bvec_count(&server->handlers); i++)
     {
         bhttp_handler *handler = bvec_get(&server->handlers, i);
-        if (!(handler->methods & req->method)) continue;
-        //printf("handler: %s\n", bstr_cstring(&handler->match));
-        //printf("URI: %s\n", bstr_cstring(&req->uri_path));
-
-        bvec *args; /* in case we need to store matches from a regex handler */
-        switch(handler->type)
+        if (!(handler->methods & req->method))
         {
-            case BHTTP_HANDLER_SIMPLE:
-                if (strcmp(bstr_cstring(&handler->match), bstr_cstring(&req->uri_path)) == 0)
-                {
-                    r = handler->cb.f_simple(req, res) ?
-                            BH_HANDLER_NZ : BH_HANDLER_OK;
-                    goto exit;
-                }
-                break;
-            case BHTTP_HANDLER_REGEX:
-                args = regex_match_handler(handler, &req->uri_path);
-                if (args != NULL)
-                {
-                    r = handler->cb.f_regex(req, res, args);
-                    bvec_free(args);
-                    r = r ? BH_HANDLER_NZ : BH_HANDLER_OK;
-                    goto exit;
-                }
-                break;
-            case BHTTP_HANDLER_LUA:
-                if (strcmp(bstr_cstring(&handler->match), bstr_cstring(&req->uri_path)) == 0)
-                {
-                    r = handler->cb.f_lua(req, res, handler->lua_file, handler->lua_cb_func) ?
-                            BH_HANDLER_NZ : BH_HANDLER_OK;
-                    goto exit;
-                }
-                break;
+            /* the path is there for some other method */
+            if (req->route == BHTTP_404 && handler_matches_path(handler, req))
+                req->route = BHTTP_405;
+            continue;
+        }
+        if (handler->type == BHTTP_HANDLER_REGEX)
+        {
+            /* the groups are kept for the handler, the regex only runs once */
+            if ((req->route_args = regex_match_handler(handler, &req->uri_path)) == NULL)
+                continue;
         }
+        else if (strcmp(bstr_cstring(&handler->match), bstr_cstring(&req->uri_path)) != 0)
+            continue;
+        req->handler = handler;
+        req->route = 0;
+        if (handler->has_body_opts)
+            req->body_opts = handler->body_opts;
+        break;
+    }
+    UNLOCK(server);
+}
+
+static void
+add_allow_header(bhttp_server *server, bhttp_request *req, bhttp_response *res)
+/* the methods accepted on req's path, for a 405 */
+{
+    uint32_t methods = 0;
+    READ_LOCK(server);
+    for (int i = 0; i < bvec_count(&server->handlers); i++)
+    {
+        bhttp_handler *handler = bvec_get(&server->handlers, i);
+        if (handler_matches_path(handler, req))
+            methods |= handler->methods;
+    }
+    UNLOCK(server);
+    bstr allow;
+    bstr_init(&allow);
+#define C(num, name) \
+    if (methods & BHTTP_##name) \
+        bstr_append_printf(&allow, "%s%s", bstr_size(&allow) > 0 ? ", " : "", #name);
+    BHTTP_METHOD_MAP(C)
+#undef C
+    bhttp_res_add_header(res, "allow", bstr_cstring(&allow));
+    bstr_free_contents(&allow);
+}
+
+static int
+run_handler(bhttp_handler *handler, bhttp_request *req, bhttp_response *res, bvec *args)
+/* calls into user code, whatever it allocates for itself comes from the heap
+ * as it may outlive the request */
+{
+    int heap = bhttp_arena_heap_only(1);
+    int r = 0;
+    switch(handler->type)
+    {
+        case BHTTP_HANDLER_SIMPLE:
+            r = handler->cb.f_simple(req, res);
+            break;
+        case BHTTP_HANDLER_REGEX:
+            r = handler->cb.f_regex(req, res, args);
+            break;
+        case BHTTP_HANDLER_LUA:
+            r = handler->cb.f_lua(req, res, handler->lua_file, handler->lua_cb_func);
+            break;
+    }
+    bhttp_arena_heap_only(heap);
+    return r;
+}
+
+static int
+match_handler(bhttp_server *server, bhttp_request *req, bhttp_response *res)
+{
+    /* return value from handlers */
+    int r;
+    READ_LOCK(server);
+    /* picked by bhttp_server_route once the head was parsed */
+    if (req->handler != NULL)
+    {
+        r = run_handler(req->handler, req, res, req->route_args) ?
+                BH_HANDLER_NZ : BH_HANDLER_OK;
     }
     /* no handler found, try serving a file */
-    if (req->method & BHTTP_GET || req->method & BHTTP_HEAD)
+    else if (req->route == 0)
     {
         r = default_file_handler(req, res) ?
                 BH_HANDLER_NZ : BH_HANDLER_OK;
-        goto exit;
     }
     else
         r = BH_HANDLER_NO_MATCH;
-exit:
     UNLOCK(server);
     return r;
 }
 
-static void *
-do_connection(void * arg)
+void
+bhttp_server_respond(bhttp_server *server, bhttp_request *req, bhttp_out *out)
+/* runs the matching handler for a fully parsed request and writes the response */
 {
-    bhttp_server *server = ((thread_args *)arg)->server;
-    int sock = ((thread_args *)arg)->sock;
-    const char *ipstr = ((thread_args *)arg)->ipstr;
+    bhttp_response res;
+    bhttp_response_init(&res);
+    /* queue the header block and body so they leave in a single write */
+    int direct = !out->collect;
+    out->collect = 1;
+    /* refused while it was read */
+    if (req->reject)
+    {
+        if (req->reject == BHTTP_405)
+            add_allow_header(server, req, &res);
+        send_reject_response(out, &res, req->reject);
+    }
+    /* check http method */
+    else if (req->method != BHTTP_UNSUPPORTED_METHOD)
+    {
+        int hr = match_handler(server, req, &res);
+        if (hr == BH_HANDLER_OK)
+        {
+            write_response(server, &res, req, out);
+        }
+        else if (hr == BH_HANDLER_NZ)
+        {
+            send_500_response(out, &res);
+        }
+        else if (hr == BH_HANDLER_NO_MATCH && req->route == BHTTP_405)
+        {
+            add_allow_header(server, req, &res);
+            send_405_response(out, &res);
+        }
+        else if (hr == BH_HANDLER_NO_MATCH)
+        {
+            send_404_response(out, &res, NULL);
+        }
+    }
+    /* unsupported http method */
+    else
+    {
+        send_501_response(out, &res);
+    }
+    if (direct)
+    {
+        out->collect = 0;
+        /* a response cut short leaves the client unable to find the next one */
+        if (bhttp_out_flush(out) != 0)
+            req->keep_alive = BHTTP_CLOSE;
+    }
+    bhttp_response_free(&res);
+    __atomic_add_fetch(&server->requests, 1, __ATOMIC_RELAXED);
+}
 
+void
+bhttp_server_serve_connection(bhttp_server *server, int sock, const char *ipstr)
+/* handles requests on sock until the client stops asking for keep-alive, then closes it */
+{
     bhttp_request req;
+    bhttp_readbuf rb;
+    bhttp_out out;
+    bhttp_arena arena;
+    /* a refused request may have left its body unread */
+    int drain = 0;
+    bhttp_readbuf_init(&rb);
+    bhttp_out_init(&out, sock, server->use_sendfile, 0);
+    /* requests and responses of this connection allocate from here */
+    bhttp_arena_init(&arena, server->arena_size, NULL);
+    bhttp_arena *prev = bhttp_arena_use(&arena);
     /* handle req while keep-alive requested */
     do
     {
-        /* read a new req */
+        /* the last request is gone, its memory can be reused unless
+         * its response is still queued */
+        if (bhttp_out_queued(&out) == 0)
+            bhttp_arena_reset(&arena);
+        /* read a new req, possibly already pipelined in rb */
         bhttp_request_init(&req);
         req.ip = ipstr;
-        int r = receive_data(&req, sock);
+        req.server = server;
+        if (bhttp_request_feed(&req, &rb) == BHTTP_REQ_OK && !req.done)
+        {
+            /* about to block on the client, send it what we owe first */
+            if (bhttp_out_flush(&out) != 0)
+            {
+                bhttp_request_free(&req);
+                break;
+            }
+        }
+        int r = receive_data(&req, &rb, sock);
         /* error handling req, break, don't bother being nice */
         if (r != BHTTP_REQ_OK)
         {
@@ -871,41 +1513,79 @@ do_connection(void * arg)
         /* handle req if no error returned */
         else
         {
-            bhttp_response res;
-            bhttp_response_init(&res);
-            /* check http method */
-            if (req.method != BHTTP_UNSUPPORTED_METHOD)
-            {
-                int hr = match_handler(server, &req, &res);
-                if (hr == BH_HANDLER_OK)
-                {
-                    write_response(server, &res, &req, sock);
-                }
-                else if (hr == BH_HANDLER_NZ)
-                {
-                    send_500_response(sock, &res);
-                }
-                else if (hr == BH_HANDLER_NO_MATCH)
-                {
-                    send_404_response(sock, &res);
-                }
-            }
-            /* unsupported http method */
-            else
-            {
-                send_501_response(sock, &res);
-            }
-            bhttp_response_free(&res);
+            /* batch responses to pipelined requests into fewer writes */
+            out.collect = rb.size > rb.parsed || bhttp_out_queued(&out) > 0;
+            bhttp_server_respond(server, &req, &out);
+            drain = req.reject != 0;
         }
         //write_log(server, &req, s);
         bhttp_request_free(&req);
     } while (req.keep_alive == BHTTP_KEEP_ALIVE);
     /* cleanup */
+    bhttp_out_flush(&out);
+    bhttp_out_free(&out);
+    bhttp_arena_free(&arena);
+    bhttp_arena_use(prev);
+    bhttp_readbuf_free(&rb);
+    bhttp_server_close_conn(sock, drain);
+}
+
+void
+bhttp_server_close_conn(int sock, int drain)
+/* draining lets the client read a 413 that was sent before the body it was
+ * still uploading, closing with unread data would reset the connection */
+{
+    if (drain)
+    {
+        char buf[4096];
+        shutdown(sock, SHUT_WR);
+        /* bounded, a client that keeps sending gets the reset anyway */
+        for (int i = 0; i < 16 && recv(sock, buf, sizeof buf, MSG_DONTWAIT) > 0; i++)
+            ;
+    }
     close(sock);
+}
+
+static void *
+do_connection(void * arg)
+{
+    thread_args *args = arg;
+    bhttp_server_serve_connection(args->server, args->sock, args->ipstr);
     free(arg);
     return NULL;
 }
 
+static void
+queue_connection(bhttp_shard *shard, int con, struct sockaddr_storage *addr)
+/* hands an accepted connection to the worker pool, applying the full-queue policy */
+{
+    bhttp_server *server = shard->server;
+    bhttp_pool_job job;
+    job.sock = con;
+    if (fill_ip(addr, job.ipstr, sizeof job.ipstr) != 0)
+    {
+        fprintf(stderr, "Could not get IP address of client\n");
+        close(con);
+        return;
+    }
+
+    if (bhttp_pool_push(shard->pool, &job, server->pool_policy == BHTTP_POOL_BLOCK) == 0)
+        return;
+
+    if (server->pool_policy == BHTTP_POOL_SHED)
+    {
+        bhttp_response res;
+        bhttp_out out;
+        bhttp_response_init(&res);
+        bhttp_out_init(&out, con, 0, 1);
+        send_503_response(&out, &res);
+        bhttp_out_flush(&out);
+        bhttp_out_free(&out);
+        bhttp_response_free(&res);
+    }
+    close(con);
+}
+
 int
 fill_ip(struct sockaddr_storage *addr, char *dest, size_t size)
 /* writes in ip from addr into dest string, size is size of dest buffer */
@@ -927,10 +1607,43 @@ fill_ip(struct sockaddr_storage *addr, char *dest, size_t size)
     return 0;
 }
 
-void
-bhttp_server_run(bhttp_server *server)
-/* start accepting connections */
+static void
+pin_to_cpu(int cpu)
+/* threads started from here on inherit the same affinity */
+{
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0)
+        fprintf(stderr, "Could not pin acceptor to cpu %d\n", cpu);
+}
+
+static void
+run_shard(bhttp_shard *shard)
+/* start accepting connections on one listener */
 {
+    bhttp_server *server = shard->server;
+    pin_to_cpu(shard->cpu);
+
+#ifdef URING
+    if (server->io_model == BHTTP_IO_URING)
+    {
+        /* only returns on error, unless the kernel has no io_uring */
+        if (bhttp_uring_run(shard) == 0)
+            return;
+        fprintf(stderr, "io_uring unavailable, falling back to epoll\n");
+        bhttp_reactor_run(shard);
+        return;
+    }
+#endif
+    if (server->io_model == BHTTP_IO_EPOLL)
+    {
+        /* only returns on error */
+        bhttp_reactor_run(shard);
+        return;
+    }
+
     pthread_attr_t detached_attr;
     pthread_attr_init(&detached_attr);
     pthread_attr_setdetachstate(&detached_attr, PTHREAD_CREATE_DETACHED);
@@ -945,11 +1658,18 @@ bhttp_server_run(bhttp_server *server)
     while(1) {
         sin_size = sizeof their_addr;
         //printf("Waiting on connection...\n");
-        con = accept(server->sock, (struct sockaddr *)&their_addr, &sin_size);
+        con = accept(shard->sock, (struct sockaddr *)&their_addr, &sin_size);
         if (con == -1) {
             perror("accept");
             continue;
         }
+        __atomic_add_fetch(&shard->accepts, 1, __ATOMIC_RELAXED);
+
+        if (shard->pool != NULL)
+        {
+            queue_connection(shard, con, &their_addr);
+            continue;
+        }
 
         /* start new thread to handle connection */
         thread_args *args = malloc(sizeof(thread_args));
@@ -984,9 +1704,59 @@ bhttp_server_run(bhttp_server *server)
     }
 }
 
+static void *
+shard_thread(void *arg)
+{
+    run_shard(arg);
+    return NULL;
+}
+
+static void
+stop_shard_threads(bhttp_server *server, int count)
+/* stops the acceptors of shards 1 to count - 1. the epoll and io_uring loops
+ * run handlers, which may hold the server's read lock, so rather than being
+ * cancelled they are asked to return. only a thread blocked in accept is
+ * cancelled */
+{
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 1; i < count; i++)
+    {
+        if (server->io_model == BHTTP_IO_THREADS)
+            pthread_cancel(server->shard[i].thread);
+        pthread_join(server->shard[i].thread, NULL);
+    }
+}
+
+static void
+stop_shards(void *arg)
+{
+    bhttp_server *server = arg;
+    stop_shard_threads(server, server->shard_count);
+}
+
+void
+bhttp_server_run(bhttp_server *server)
+/* start accepting connections, the calling thread serves the first shard */
+{
+    for (int i = 1; i < server->shard_count; i++)
+    {
+        if (pthread_create(&server->shard[i].thread, NULL, shard_thread, &server->shard[i]) != 0)
+        {
+            fprintf(stderr, "Could not create acceptor thread for shard %d\n", i);
+            stop_shard_threads(server, i);
+            return;
+        }
+    }
+
+    pthread_cleanup_push(stop_shards, server);
+    run_shard(&server->shard[0]);
+    pthread_cleanup_pop(1);
+}
+
 int
 bhttp_server_start(bhttp_server *server, int own_thread)
 {
+    __atomic_store_n(&server->stopping, 0, __ATOMIC_RELEASE);
     if (bhttp_server_bind(server))
     /* first try to bind to ip and port */
     {
@@ -994,6 +1764,23 @@ bhttp_server_start(bhttp_server *server, int own_thread)
         return 1;
     }
 
+    if (server->io_model == BHTTP_IO_THREADS && server->pool_workers > 0)
+    /* pre-start a worker pool for every shard */
+    {
+        for (int i = 0; i < server->shard_count; i++)
+        {
+            bhttp_shard *shard = &server->shard[i];
+            shard->pool = bhttp_pool_new(server, server->pool_workers,
+                                         server->pool_queue_depth, shard->cpu);
+            if (shard->pool == NULL)
+            {
+                fprintf(stderr, "Unable to start worker pool\n");
+                free_shards(server);
+                return 1;
+            }
+        }
+    }
+
     if (!own_thread)
     /* start bittyhttp and never return unless there's an error */
     {
@@ -1024,18 +1811,25 @@ bhttp_server_start(bhttp_server *server, int own_thread)
 int
 bhttp_server_stop(bhttp_server *server)
 {
-    if (WRITE_LOCK(server))
+    /* the epoll and io_uring loops finish the batch they are on, handlers
+     * included, and return within a second. the thread model's acceptor
+     * is cancelled while it waits in accept, it never runs handlers */
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+    if (server->io_model == BHTTP_IO_THREADS && pthread_cancel(server->thread_id))
     {
-        fprintf(stderr, "could not get mutex rwlock on server\n");
+        fprintf(stderr, "error cancelling bittyhttp server thread\n");
         return 1;
     }
-    if (pthread_cancel(server->thread_id))
+    pthread_join(server->thread_id, NULL);
+    if (WRITE_LOCK(server))
     {
-        fprintf(stderr, "error cancelling bittyhttp server thread\n");
+        fprintf(stderr, "could not get mutex rwlock on server\n");
         return 1;
     }
-    pthread_join(server->thread_id, NULL);
     server->state = BHTTP_SERVER_STATE_OFF;
     UNLOCK(server);
+
+    /* workers take the read lock while matching handlers, so stop them unlocked */
+    free_shards(server);
     return 0;
 }
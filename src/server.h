@@ -14,6 +14,9 @@
 #include "request.h"
 #include "respond.h"
 #include "mime_types.h"
+#include "pool.h"
+#include "output.h"
+#include "arena.h"
 
 #define SEND_BUFFER_SIZE 4096
 
@@ -35,6 +38,63 @@ typedef enum {
     BHTTP_SERVER_STATE_RUNNING
 } bhttp_server_state;
 
+typedef enum {
+    BHTTP_IO_THREADS = 0,   /* one thread per connection */
+    BHTTP_IO_EPOLL,         /* single edge-triggered epoll reactor */
+    BHTTP_IO_URING          /* io_uring loop, needs `make URING=1` */
+} bhttp_io_model;
+
+/* one listening socket with its own acceptor thread and workers */
+typedef struct bhttp_shard
+{
+    struct bhttp_server *server;
+    int index;
+    int sock;
+    /* cpu the acceptor and its workers are pinned to, -1 for none */
+    int cpu;
+    pthread_t thread;
+    /* connections accepted on this listener, updated atomically */
+    uint64_t accepts;
+    bhttp_pool *pool;
+} bhttp_shard;
+
+/* how much and how fast clients have to send a request, 0 turns a limit off */
+typedef struct bhttp_limits {
+    /* seconds from the first byte of a request to the end of its head, 408 */
+    int head_timeout;
+    /* request line and headers, 431. http_parser stops at 80 KB anyway */
+    size_t max_head_size;
+    /* 431 */
+    int max_headers;
+    /* request target, 414 */
+    size_t max_uri;
+    /* bytes per second a body has to average once TIMEOUT_SECONDS have
+     * passed since its head, 408 */
+    size_t min_rate;
+} bhttp_limits;
+
+/* requests refused by bhttp_limits, and by body max_size */
+typedef struct bhttp_limit_stats {
+    uint64_t head_timeouts;
+    uint64_t slow_bodies;
+    uint64_t heads_too_large;
+    uint64_t too_many_headers;
+    uint64_t uris_too_long;
+    uint64_t bodies_too_large;
+} bhttp_limit_stats;
+
+/* gzip or deflate for bodies built in memory, needs `make ZLIB=1` */
+typedef struct bhttp_compress_opts {
+    /* 1 fastest to 9 smallest, 0 turns compression off */
+    int level;
+    /* smaller bodies are sent as they are */
+    size_t min_size;
+} bhttp_compress_opts;
+
+/* bhttp_server.shards value that opens one listener per cpu the process
+ * may run on */
+#define BHTTP_SHARDS_PER_CPU 0
+
 /* bhttp_server structures stores information about the current server */
 typedef struct bhttp_server
 {
@@ -51,14 +111,40 @@ typedef struct bhttp_server
 
     /* not-so-basic config */
     int use_sendfile;
+    bhttp_io_model io_model;
+    /* worker pool for the threads io model, one per shard
+     * 0 workers starts a thread per connection */
+    int pool_workers;
+    int pool_queue_depth;
+    bhttp_pool_policy pool_policy;
+    /* number of SO_REUSEPORT listeners, 1 is a single plain listener */
+    int shards;
+    /* block size of the per-connection arenas, 0 allocates from the heap */
+    size_t arena_size;
+    /* requests answered, updated atomically */
+    uint64_t requests;
+    /* request body handling for routes without their own */
+    bhttp_body_opts body_opts;
+    /* read budgets for every request */
+    bhttp_limits limits;
+    /* updated atomically */
+    bhttp_limit_stats limit_stats;
+    /* response compression */
+    bhttp_compress_opts compress;
 
-    /* main socket */
+    /* main socket, the first shard's listener */
     int sock;
+    /* listeners, set up by bhttp_server_start */
+    bhttp_shard *shard;
+    int shard_count;
 
     /* thread_id info and mutex */
     pthread_t thread_id;
     pthread_rwlock_t rwlock;
     bhttp_server_state state;
+    /* set atomically by bhttp_server_stop, the epoll and io_uring loops
+     * return once they see it */
+    int stopping;
 } bhttp_server;
 
 /* http server init and begin functions */
@@ -68,6 +154,18 @@ int bhttp_server_set_ip(bhttp_server *server, const char *ip);
 int bhttp_server_set_port(bhttp_server *server, const char *port);
 int bhttp_server_set_docroot(bhttp_server *server, const char *docroot);
 int bhttp_server_set_dfile(bhttp_server *server, const char *dfile);
+int bhttp_server_set_io_model(bhttp_server *server, bhttp_io_model model);
+int bhttp_server_set_pool(bhttp_server *server, int workers, int queue_depth, bhttp_pool_policy policy);
+int bhttp_server_get_pool_stats(bhttp_server *server, bhttp_pool_stats *stats);
+int bhttp_server_set_shards(bhttp_server *server, int shards);
+int bhttp_server_get_shard_count(bhttp_server *server);
+uint64_t bhttp_server_get_shard_accepts(bhttp_server *server, int shard);
+int bhttp_server_set_arena_size(bhttp_server *server, size_t block_size);
+int bhttp_server_set_body_opts(bhttp_server *server, const bhttp_body_opts *opts);
+void bhttp_server_get_alloc_stats(bhttp_server *server, bhttp_alloc_stats *stats);
+int bhttp_server_set_limits(bhttp_server *server, const bhttp_limits *limits);
+void bhttp_server_get_limit_stats(bhttp_server *server, bhttp_limit_stats *stats);
+int bhttp_server_set_compression(bhttp_server *server, const bhttp_compress_opts *opts);
 
 int bhttp_server_start(bhttp_server *server, int own_thread);
 int bhttp_server_stop(bhttp_server *server);
@@ -81,6 +179,8 @@ int bhttp_add_regex_handler(bhttp_server *server,
                             uint32_t methods,
                             const char *uri,
                             int (*cb)(bhttp_request *, bhttp_response *, bvec *));
+/* body handling for the handlers added with this uri, or pattern for regex handlers */
+int bhttp_handler_set_body_opts(bhttp_server *server, const char *uri, const bhttp_body_opts *opts);
 #ifdef LUA
 int bhttp_add_lua_handler(bhttp_server *server,
                           uint32_t methods,
@@ -88,4 +188,14 @@ int bhttp_add_lua_handler(bhttp_server *server,
                           const char * lua_script_path, const char * lua_cb_func_name);
 #endif
 
+/* shared by the connection models, not meant for handlers */
+void bhttp_server_respond(bhttp_server *server, bhttp_request *req, bhttp_out *out);
+void bhttp_server_serve_connection(bhttp_server *server, int sock, const char *ipstr);
+/* finds the handler req goes to and its body options, called once its head
+ * is parsed so a request nothing will answer is refused before its body */
+void bhttp_server_route(bhttp_server *server, bhttp_request *req);
+/* closes sock, reading what the client already sent first if drain is set */
+void bhttp_server_close_conn(int sock, int drain);
+int fill_ip(struct sockaddr_storage *addr, char *dest, size_t size);
+
 #endif /* BITTYHTTP_SERVER_H */
@@ -0,0 +1,833 @@
+/*
+ *  uring.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+/* only built with `make URING=1` */
+#ifdef URING
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "server.h"
+
+#define URING_ENTRIES       256
+#define URING_BUF_COUNT     256
+#define URING_BUF_SIZE      4096
+#define URING_BUF_GROUP     0
+#define URING_SPLICE_CHUNK  65536
+#define URING_IOV           64
+#define URING_ARENA_SPARES  64
+
+/*
+ * The loop talks to the kernel through the raw io_uring syscalls, so no extra
+ * library is needed. Accepts are multishot where the kernel supports it,
+ * reads pick a buffer from a group provided up front, responses are queued
+ * by bhttp_server_respond into a collecting bhttp_out and then sent as one
+ * gathered sendmsg, linked to the splice of any file that follows through a
+ * per-connection pipe.
+ * Handlers run on the loop thread, same as the epoll reactor.
+ */
+
+/* what a completion belongs to, kept in the low bits of user_data */
+enum {
+    OP_ACCEPT = 0,
+    OP_RECV,
+    OP_SEND,
+    OP_SPLICE_IN,   /* file -> pipe */
+    OP_SPLICE_OUT,  /* pipe -> socket */
+    OP_IGNORE,      /* provided buffers and link timeouts */
+    OP_TICK,        /* wakes the loop once a second so it sees a stop */
+    OP_UPLOAD       /* socket -> pipe, for uploads going to a file */
+};
+#define OP_MASK 0x7
+
+typedef struct
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    /* sqes handed out but not yet submitted */
+    unsigned local_tail;
+    unsigned to_submit;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+} ring;
+
+typedef struct uring_conn
+{
+    int sock;
+    char ipstr[INET6_ADDRSTRLEN];
+    bhttp_request req;
+    /* bytes not parsed yet, may hold pipelined requests */
+    bhttp_readbuf rb;
+    /* requests and responses allocate from here, see arena.h */
+    bhttp_arena arena;
+    bhttp_out out;
+    int keep_alive;
+    /* write cursor into out.segs */
+    int seg;
+    uint64_t seg_off;
+    /* buffers gathered into the sendmsg in flight */
+    struct iovec iov[URING_IOV];
+    struct msghdr msg;
+    /* file of the current segment, -1 if none */
+    int file;
+    /* used to splice files, created on first use */
+    int pipe[2];
+    uint64_t piped;
+    /* operations submitted and not completed */
+    int inflight;
+    int failed;
+    /* a refused request may have left its body unread */
+    int drain;
+    struct uring_conn *prev;
+    struct uring_conn *next;
+} uring_conn;
+
+typedef struct
+{
+    bhttp_server *server;
+    bhttp_shard *shard;
+    ring ring;
+    char *bufs;
+    int multishot;
+    struct __kernel_timespec tick;
+    struct __kernel_timespec idle;
+    uring_conn *conns;
+    bhttp_arena_spares spares;
+} uring_loop;
+
+static int
+ring_setup(ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    memset(r, 0, sizeof *r);
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return 1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto bad;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else
+    {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+        {
+            munmap(r->sq_ptr, r->sq_len);
+            goto bad;
+        }
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+        munmap(r->sq_ptr, r->sq_len);
+        goto bad;
+    }
+
+    r->sq_entries = p.sq_entries;
+    r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    r->local_tail = *r->sq_tail;
+    return 0;
+
+bad:
+    close(r->fd);
+    return 1;
+}
+
+static void
+ring_free(ring *r)
+{
+    munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+static int
+ring_submit(ring *r, unsigned wait)
+/* submits queued sqes, waiting for at least wait completions */
+{
+    __atomic_store_n(r->sq_tail, r->local_tail, __ATOMIC_RELEASE);
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait,
+                           wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0)
+        return -1;
+    r->to_submit -= (unsigned)ret;
+    return 0;
+}
+
+static struct io_uring_sqe *
+ring_sqe(ring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->local_tail - head >= r->sq_entries)
+    {
+        /* queue is full, hand what we have to the kernel first */
+        if (ring_submit(r, 0) != 0)
+            return NULL;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->local_tail - head >= r->sq_entries)
+            return NULL;
+    }
+    unsigned idx = r->local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof *sqe);
+    r->sq_array[idx] = idx;
+    r->local_tail++;
+    r->to_submit++;
+    return sqe;
+}
+
+#define CONN_DATA(c, op) ((uint64_t)(uintptr_t)(c) | (op))
+
+static void
+arm_accept(uring_loop *l)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->shard->sock;
+    if (l->multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void
+arm_tick(uring_loop *l)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&l->tick;
+    sqe->len = 1;
+    sqe->user_data = OP_TICK;
+}
+
+static void
+provide_buffers(uring_loop *l, int bid, int count)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(l->bufs + (size_t)bid * URING_BUF_SIZE);
+    sqe->len = URING_BUF_SIZE;
+    sqe->off = (uint64_t)bid;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = OP_IGNORE;
+}
+
+static void
+link_idle_timeout(uring_loop *l, struct io_uring_sqe *sqe)
+/* cancels sqe if the client sends nothing for TIMEOUT_SECONDS */
+{
+    struct io_uring_sqe *timeout = ring_sqe(&l->ring);
+    if (timeout == NULL) return;
+    sqe->flags |= IOSQE_IO_LINK;
+    timeout->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout->addr = (uint64_t)(uintptr_t)&l->idle;
+    timeout->len = 1;
+    timeout->user_data = OP_IGNORE;
+}
+
+static int
+arm_recv(uring_loop *l, uring_conn *c)
+/* reads into a provided buffer, giving up after TIMEOUT_SECONDS */
+{
+    struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+    if (sqe == NULL)
+        return 1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sock;
+    sqe->len = URING_BUF_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = CONN_DATA(c, OP_RECV);
+    c->inflight++;
+    link_idle_timeout(l, sqe);
+    return 0;
+}
+
+static int
+arm_upload(uring_loop *l, uring_conn *c)
+/* splices the next part of an upload from the socket into the pipe, it is
+ * moved on to the upload fd once it completes */
+{
+    if (c->pipe[0] < 0 && pipe(c->pipe) != 0)
+        return 1;
+    struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+    if (sqe == NULL)
+        return 1;
+    uint64_t left = bhttp_request_splice_left(&c->req);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = c->sock;
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->fd = c->pipe[1];
+    sqe->off = (uint64_t)-1;
+    sqe->len = left < URING_SPLICE_CHUNK ? (uint32_t)left : URING_SPLICE_CHUNK;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = CONN_DATA(c, OP_UPLOAD);
+    c->inflight++;
+    link_idle_timeout(l, sqe);
+    return 0;
+}
+
+static void
+conn_close(uring_loop *l, uring_conn *c)
+{
+    if (c->prev) c->prev->next = c->next;
+    else l->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+
+    bhttp_server_close_conn(c->sock, c->drain);
+    if (c->file >= 0) close(c->file);
+    if (c->pipe[0] >= 0)
+    {
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+    }
+    bhttp_arena *prev = bhttp_arena_use(&c->arena);
+    bhttp_request_free(&c->req);
+    bhttp_out_free(&c->out);
+    bhttp_arena_free(&c->arena);
+    bhttp_arena_use(prev == &c->arena ? NULL : prev);
+    bhttp_readbuf_free(&c->rb);
+    free(c);
+}
+
+static void conn_next(uring_loop *l, uring_conn *c);
+
+static void
+conn_write(uring_loop *l, uring_conn *c)
+/* submits the next part of the queued response, only called with nothing in flight */
+{
+    if (c->failed)
+    {
+        conn_close(l, c);
+        return;
+    }
+
+    /* finish moving what is already in the pipe */
+    if (c->piped > 0)
+    {
+        struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+        if (sqe == NULL)
+        {
+            conn_close(l, c);
+            return;
+        }
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = c->pipe[0];
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->fd = c->sock;
+        sqe->off = (uint64_t)-1;
+        sqe->len = (uint32_t)c->piped;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->user_data = CONN_DATA(c, OP_SPLICE_OUT);
+        c->inflight++;
+        return;
+    }
+
+    int count = bvec_count(&c->out.segs);
+    if (c->seg >= count)
+    {
+        /* response is out */
+        bhttp_out_reset(&c->out);
+        if (!bhttp_request_started(&c->req))
+            bhttp_arena_reset(&c->arena);
+        if (!c->keep_alive)
+            conn_close(l, c);
+        else
+            conn_next(l, c);
+        return;
+    }
+
+    /* one sendmsg for every buffer up to the next file, linked to a chunk of it.
+     * a stream's piece is sent with them, and nothing after it until the
+     * stream has ended */
+    int n = 0;
+    int i = c->seg;
+    int streaming = 0;
+    for (; i < count && n < URING_IOV; i++)
+    {
+        bhttp_out_seg *seg = bvec_get(&c->out.segs, i);
+        uint64_t off = i == c->seg ? c->seg_off : 0;
+        if (seg->type == BHTTP_OUT_STREAM)
+        {
+            /* the last piece is out, ask for the next */
+            if (off >= seg->buf_len && !seg->ended)
+            {
+                off = 0;
+                if (i == c->seg)
+                    c->seg_off = 0;
+                if (bhttp_out_stream_fill(seg) < 0)
+                {
+                    c->failed = 1;
+                    break;
+                }
+            }
+            if (off >= seg->buf_len)
+            {
+                /* ended with nothing left to send */
+                if (i == c->seg)
+                {
+                    c->seg++;
+                    c->seg_off = 0;
+                }
+                continue;
+            }
+            c->iov[n].iov_base = seg->buf + seg->buf_off + off;
+            c->iov[n].iov_len = (size_t)(seg->buf_len - off);
+            n++;
+            if (!seg->ended)
+            {
+                streaming = 1;
+                break;
+            }
+            continue;
+        }
+        if (seg->type != BHTTP_OUT_BUF)
+            break;
+        c->iov[n].iov_base = (char *)seg->bytes + off;
+        c->iov[n].iov_len = (size_t)(seg->size - off);
+        n++;
+    }
+
+    bhttp_out_seg *file = !streaming && !c->failed && i < count && n < URING_IOV ?
+                          bvec_get(&c->out.segs, i) : NULL;
+    /* only empty streams were left */
+    if (n == 0 && file == NULL && !c->failed)
+    {
+        conn_write(l, c);
+        return;
+    }
+    if (file != NULL)
+    {
+        if (c->file < 0 && (c->file = open(bstr_cstring(&file->data), O_RDONLY)) < 0)
+        {
+            fprintf(stderr, "Cannot open file %d\n", errno);
+            c->failed = 1;
+            file = NULL;
+        }
+        else if (c->pipe[0] < 0 && pipe(c->pipe) != 0)
+        {
+            c->failed = 1;
+            file = NULL;
+        }
+    }
+
+    struct io_uring_sqe *send = NULL;
+    if (n > 0)
+    {
+        struct io_uring_sqe *sqe = send = ring_sqe(&l->ring);
+        if (sqe == NULL)
+        {
+            conn_close(l, c);
+            return;
+        }
+        memset(&c->msg, 0, sizeof c->msg);
+        c->msg.msg_iov = c->iov;
+        c->msg.msg_iovlen = (size_t)n;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = c->sock;
+        sqe->addr = (uint64_t)(uintptr_t)&c->msg;
+        sqe->len = 1;
+        /* let the headers wait for the first file bytes */
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (file != NULL ? MSG_MORE : 0);
+        sqe->user_data = CONN_DATA(c, OP_SEND);
+        if (file != NULL)
+            sqe->flags |= IOSQE_IO_LINK;
+        c->inflight++;
+    }
+
+    if (file != NULL)
+    {
+        struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+        if (sqe != NULL)
+        {
+            uint64_t off = i == c->seg ? c->seg_off : 0;
+            uint64_t left = file->size - off;
+            sqe->opcode = IORING_OP_SPLICE;
+            sqe->splice_fd_in = c->file;
+            sqe->splice_off_in = file->offset + off;
+            sqe->fd = c->pipe[1];
+            sqe->off = (uint64_t)-1;
+            sqe->len = left < URING_SPLICE_CHUNK ? (uint32_t)left : URING_SPLICE_CHUNK;
+            sqe->splice_flags = SPLICE_F_MOVE;
+            sqe->user_data = CONN_DATA(c, OP_SPLICE_IN);
+            c->inflight++;
+        }
+        else if (send != NULL)
+        {
+            /* ring is full, the file goes out after this completes */
+            send->flags &= ~IOSQE_IO_LINK;
+            send->msg_flags &= ~MSG_MORE;
+        }
+    }
+
+    if (c->inflight == 0)
+        conn_close(l, c);
+}
+
+static void
+advance(uring_conn *c, uint64_t n)
+/* moves the write cursor past n bytes, which may span several buffers */
+{
+    while (n > 0 && c->seg < bvec_count(&c->out.segs))
+    {
+        bhttp_out_seg *seg = bvec_get(&c->out.segs, c->seg);
+        if (seg->type == BHTTP_OUT_STREAM)
+        {
+            /* stays on the stream until its last piece is sent */
+            uint64_t step = seg->buf_len - c->seg_off < n ? seg->buf_len - c->seg_off : n;
+            c->seg_off += step;
+            n -= step;
+            if (c->seg_off < seg->buf_len || !seg->ended)
+                break;
+            c->seg++;
+            c->seg_off = 0;
+            continue;
+        }
+        uint64_t step = seg->size - c->seg_off < n ? seg->size - c->seg_off : n;
+        c->seg_off += step;
+        n -= step;
+        if (c->seg_off >= seg->size)
+        {
+            if (seg->type == BHTTP_OUT_FILE && c->file >= 0)
+            {
+                close(c->file);
+                c->file = -1;
+            }
+            c->seg++;
+            c->seg_off = 0;
+        }
+    }
+}
+
+static void
+conn_respond(uring_loop *l, uring_conn *c)
+/* answers every complete request in the read buffer with one chain of sends */
+{
+    do
+    {
+        bhttp_server_respond(l->server, &c->req, &c->out);
+        /* the response can still close the connection */
+        c->keep_alive = c->req.keep_alive == BHTTP_KEEP_ALIVE;
+        c->drain = c->req.reject != 0;
+        bhttp_request_free(&c->req);
+        bhttp_request_init(&c->req);
+        c->req.ip = c->ipstr;
+        c->req.server = l->server;
+        /* a bad pipelined request still gets the earlier responses */
+        if (c->keep_alive && bhttp_request_feed(&c->req, &c->rb) != BHTTP_REQ_OK)
+            c->keep_alive = 0;
+    } while (c->keep_alive && c->req.done);
+    c->seg = 0;
+    c->seg_off = 0;
+    conn_write(l, c);
+}
+
+static void
+on_accept(uring_loop *l, int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        /* older kernels reject multishot accept */
+        if (res == -EINVAL && l->multishot)
+            l->multishot = 0;
+        arm_accept(l);
+    }
+    if (res < 0)
+        return;
+    __atomic_add_fetch(&l->shard->accepts, 1, __ATOMIC_RELAXED);
+
+    struct sockaddr_storage their_addr;
+    socklen_t sin_size = sizeof their_addr;
+    uring_conn *c = calloc(1, sizeof(uring_conn));
+    if (c == NULL ||
+        getpeername(res, (struct sockaddr *)&their_addr, &sin_size) != 0 ||
+        fill_ip(&their_addr, c->ipstr, sizeof c->ipstr) != 0)
+    {
+        fprintf(stderr, "Could not set up connection\n");
+        free(c);
+        close(res);
+        return;
+    }
+    c->sock = res;
+    c->file = -1;
+    c->pipe[0] = c->pipe[1] = -1;
+    bhttp_request_init(&c->req);
+    c->req.ip = c->ipstr;
+    c->req.server = l->server;
+    bhttp_readbuf_init(&c->rb);
+    bhttp_arena_init(&c->arena, l->server->arena_size, &l->spares);
+    bhttp_out_init(&c->out, res, 1, 1);
+
+    c->next = l->conns;
+    if (l->conns) l->conns->prev = c;
+    l->conns = c;
+    if (arm_recv(l, c) != 0)
+        conn_close(l, c);
+}
+
+static void
+conn_next(uring_loop *l, uring_conn *c)
+/* parses what is buffered, then either responds or waits for more data */
+{
+    if (bhttp_request_feed(&c->req, &c->rb) != BHTTP_REQ_OK)
+    {
+        conn_close(l, c);
+        return;
+    }
+    if (c->req.done)
+    {
+        conn_respond(l, c);
+        return;
+    }
+    /* nothing else is queued while a request is read, the body is
+     * received once this is sent */
+    if (bhttp_request_continue(&c->req, &c->out))
+    {
+        c->keep_alive = 1;
+        c->seg = 0;
+        c->seg_off = 0;
+        conn_write(l, c);
+        return;
+    }
+    if (bhttp_request_splice_left(&c->req) > 0)
+    {
+        if (arm_upload(l, c) != 0)
+            conn_close(l, c);
+        return;
+    }
+    /* idle keep-alive connections should not hold a buffer */
+    bhttp_readbuf_shrink(&c->rb);
+    if (!bhttp_request_started(&c->req))
+        bhttp_arena_free(&c->arena);
+    if (arm_recv(l, c) != 0)
+        conn_close(l, c);
+}
+
+static void
+on_recv(uring_loop *l, uring_conn *c, int res, unsigned flags)
+/* c is closed or has a new operation in flight when this returns */
+{
+    if (res == -ENOBUFS)
+    {
+        /* every buffer is in use, they are handed back as soon as they are parsed */
+        if (arm_recv(l, c) != 0)
+            conn_close(l, c);
+        return;
+    }
+    if (res <= 0)
+    {
+        conn_close(l, c);
+        return;
+    }
+
+    int bid = (int)(flags >> IORING_CQE_BUFFER_SHIFT);
+    int r = bhttp_readbuf_append(&c->rb, l->bufs + (size_t)bid * URING_BUF_SIZE, (size_t)res);
+    provide_buffers(l, bid, 1);
+    if (r != 0)
+        conn_close(l, c);
+    else
+        conn_next(l, c);
+}
+
+static void
+on_upload(uring_loop *l, uring_conn *c, int res)
+{
+    if (res == -EINVAL)
+    {
+        /* the socket cannot be spliced from, read the rest */
+        c->req.no_splice = 1;
+        conn_next(l, c);
+        return;
+    }
+    if (res <= 0)
+    {
+        conn_close(l, c);
+        return;
+    }
+    bhttp_request_splice_pipe(&c->req, c->pipe[0], (size_t)res);
+    conn_next(l, c);
+}
+
+static void
+on_complete(uring_loop *l, uint64_t data, int res, unsigned flags)
+{
+    int op = (int)(data & OP_MASK);
+    uring_conn *c = (uring_conn *)(uintptr_t)(data & ~(uint64_t)OP_MASK);
+
+    switch (op)
+    {
+        case OP_ACCEPT:
+            on_accept(l, res, flags);
+            return;
+        case OP_TICK:
+            arm_tick(l);
+            return;
+        case OP_IGNORE:
+            return;
+    }
+
+    /* c may be closed on the way, nothing allocates after that */
+    bhttp_arena *prev = bhttp_arena_use(&c->arena);
+    c->inflight--;
+    switch (op)
+    {
+        case OP_RECV:
+            on_recv(l, c, res, flags);
+            bhttp_arena_use(prev);
+            return;
+        case OP_UPLOAD:
+            on_upload(l, c, res);
+            bhttp_arena_use(prev);
+            return;
+        case OP_SEND:
+            if (res > 0)
+                advance(c, (uint64_t)res);
+            else if (res != -ECANCELED)
+                c->failed = 1;
+            break;
+        case OP_SPLICE_IN:
+            if (res > 0)
+            {
+                c->piped += (uint64_t)res;
+                advance(c, (uint64_t)res);
+            }
+            else if (res != -ECANCELED)
+                c->failed = 1;
+            break;
+        case OP_SPLICE_OUT:
+            if (res > 0)
+                c->piped -= (uint64_t)res;
+            else if (res != -ECANCELED)
+                c->failed = 1;
+            break;
+    }
+
+    /* the whole chain has completed, carry on from the cursor */
+    if (c->inflight == 0)
+        conn_write(l, c);
+    bhttp_arena_use(prev);
+}
+
+static void
+uring_cleanup(void *arg)
+{
+    uring_loop *l = arg;
+    while (l->conns != NULL)
+        conn_close(l, l->conns);
+    bhttp_arena_spares_free(&l->spares);
+    ring_free(&l->ring);
+    free(l->bufs);
+}
+
+int
+bhttp_uring_run(bhttp_shard *shard)
+{
+    uring_loop l;
+    memset(&l, 0, sizeof l);
+    l.server = shard->server;
+    l.shard = shard;
+    l.multishot = 1;
+    l.tick.tv_sec = 1;
+    l.idle.tv_sec = TIMEOUT_SECONDS;
+    bhttp_arena_spares_init(&l.spares, URING_ARENA_SPARES);
+
+    if (ring_setup(&l.ring, URING_ENTRIES) != 0)
+    {
+        perror("io_uring_setup");
+        return 1;
+    }
+    l.bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (l.bufs == NULL)
+    {
+        ring_free(&l.ring);
+        return 1;
+    }
+
+    provide_buffers(&l, 0, URING_BUF_COUNT);
+    arm_accept(&l);
+    arm_tick(&l);
+
+    pthread_cleanup_push(uring_cleanup, &l);
+    while (1)
+    {
+        if (ring_submit(&l.ring, 1) != 0 && errno != EINTR)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+
+        unsigned head = *l.ring.cq_head;
+        unsigned tail = __atomic_load_n(l.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &l.ring.cqes[head & *l.ring.cq_mask];
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            __atomic_store_n(l.ring.cq_head, head, __ATOMIC_RELEASE);
+            on_complete(&l, data, res, flags);
+        }
+        /* bhttp_server_stop, open connections are closed on the way out */
+        if (__atomic_load_n(&l.server->stopping, __ATOMIC_ACQUIRE))
+            break;
+    }
+    pthread_cleanup_pop(1);
+    return 0;
+}
+
+#endif /* URING */
@@ -0,0 +1,19 @@
+/*
+ *  uring.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_URING_H
+#define BITTYHTTP_URING_H
+
+struct bhttp_shard;
+
+/* serves every connection of one listener from the calling thread with
+ * io_uring, returns 1 straight away if the kernel does not support it,
+ * otherwise only returns on error or when the server is stopped */
+int bhttp_uring_run(struct bhttp_shard *shard);
+
+#endif /* BITTYHTTP_URING_H */
@@ -0,0 +1,127 @@
+/*
+ *  urldecode.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "urldecode.h"
+
+static const signed char unhex_tbl[256] = {
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        0, 1, 2, 3, 4, 5, 6, 7,  8, 9,-1,-1,-1,-1,-1,-1,
+        -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1
+};
+
+static size_t
+copy_run(const char *p, const char *end, char *out)
+/* copies up to the first '%' or NUL, turning '+' into spaces, and returns
+ * how far it got. whole blocks are stored even when they hold the stop
+ * byte, out never gets ahead of p so that stays inside dest */
+{
+    const char *start = p;
+#if defined(__AVX2__)
+    const __m256i pct = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i zero = _mm256_setzero_si256();
+    while (end - p >= 32)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i *)p);
+        __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(b, pct), _mm256_cmpeq_epi8(b, zero));
+        b = _mm256_blendv_epi8(b, space, _mm256_cmpeq_epi8(b, plus));
+        _mm256_storeu_si256((__m256i *)out, b);
+        unsigned m = (unsigned)_mm256_movemask_epi8(stop);
+        if (m != 0)
+            return (size_t)(p - start) + (size_t)__builtin_ctz(m);
+        p += 32;
+        out += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i zero = _mm_setzero_si128();
+    while (end - p >= 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *)p);
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(b, pct), _mm_cmpeq_epi8(b, zero));
+        __m128i is_plus = _mm_cmpeq_epi8(b, plus);
+        b = _mm_or_si128(_mm_andnot_si128(is_plus, b), _mm_and_si128(is_plus, space));
+        _mm_storeu_si128((__m128i *)out, b);
+        unsigned m = (unsigned)_mm_movemask_epi8(stop);
+        if (m != 0)
+            return (size_t)(p - start) + (size_t)__builtin_ctz(m);
+        p += 16;
+        out += 16;
+    }
+#endif
+    while (p < end && *p != '%' && *p != '\0')
+    {
+        *out++ = *p == '+' ? ' ' : *p;
+        p++;
+    }
+    return (size_t)(p - start);
+}
+
+long
+bhttp_url_decode(const char *src, size_t len, char *dest)
+{
+    const char *p = src;
+    const char *end = src + len;
+    char *out = dest;
+    while (p < end)
+    {
+        size_t n = copy_run(p, end, out);
+        p += n;
+        out += n;
+        if (p == end)
+            break;
+        if (*p == '\0' || end - p < 3)
+            return -1;
+
+        /* escapes often come in a row, as in utf-8 text */
+        do
+        {
+            int hi = unhex_tbl[(unsigned char)p[1]];
+            int lo = unhex_tbl[(unsigned char)p[2]];
+            if (hi < 0 || lo < 0 || (hi | lo) == 0)
+                return -1;
+            *out++ = (char)(hi << 4 | lo);
+            p += 3;
+        } while (end - p >= 3 && *p == '%');
+    }
+    return (long)(out - dest);
+}
+
+const char *
+bhttp_url_decode_engine(void)
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
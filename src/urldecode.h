@@ -0,0 +1,28 @@
+/*
+ *  urldecode.h
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+#ifndef BITTYHTTP_URLDECODE_H
+#define BITTYHTTP_URLDECODE_H
+
+#include <stddef.h>
+
+/*
+ * Percent decoding for paths, query strings and form bodies. Runs without
+ * escapes are copied 32 or 16 bytes at a time with AVX2 or SSE2 when the
+ * compiler targets them, and a byte at a time otherwise.
+ */
+
+/* decodes len bytes of src into dest, which must have room for len bytes,
+ * '+' becomes a space. returns the decoded length, or -1 for a bad escape
+ * or a NUL byte, escaped or not */
+long bhttp_url_decode(const char *src, size_t len, char *dest);
+
+/* "avx2", "sse2" or "scalar" */
+const char *bhttp_url_decode_engine(void);
+
+#endif /* BITTYHTTP_URLDECODE_H */
@@ -0,0 +1,794 @@
+/*
+ *  request_test.c
+ *  bittyhttp
+ *
+ *  Created by Colin Luoma on 2026-10-17.
+ *  Copyright (c) 2026 Colin Luoma. All rights reserved.
+ */
+
+/*
+ * Checks request parsing on inputs that are awkward to send by hand, `make
+ * test` builds and runs it. Prints each failed check and exits 1 if any did.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/server.h"
+#include "../src/request.h"
+#include "../src/fastparse.h"
+#include "../src/urldecode.h"
+#include "../src/arena.h"
+
+static int failed;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); failed = 1; } } while (0)
+
+static bhttp_server *server;
+
+static int
+parse(bhttp_request *req, bhttp_readbuf *rb, const bstr *head)
+/* parses one complete request head, 0 on success */
+{
+    bhttp_readbuf_init(rb);
+    bhttp_request_init(req);
+    req->server = server;
+    bhttp_readbuf_append(rb, bstr_cstring(head), (size_t)bstr_size(head));
+    return bhttp_request_feed(req, rb) != BHTTP_REQ_OK || !req->done;
+}
+
+static void
+request_done(bhttp_request *req, bhttp_readbuf *rb)
+{
+    bhttp_request_free(req);
+    bhttp_readbuf_free(rb);
+}
+
+static int
+param_is(const bhttp_req_param *p, const char *value)
+{
+    return p != NULL && p->value_len == strlen(value) && memcmp(p->value, value, p->value_len) == 0;
+}
+
+static void
+test_params_after_many(void)
+/* more parameters than a byte can index before a new name */
+{
+    bstr head;
+    bstr_init(&head);
+    bstr_append_cstring_nolen(&head, "GET /q?");
+    for (int i = 0; i < 300; i++)
+        bstr_append_cstring_nolen(&head, "a=1&");
+    bstr_append_cstring_nolen(&head, "b=2&a=3 HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    bhttp_request req;
+    bhttp_readbuf rb;
+    CHECK(parse(&req, &rb, &head) == 0);
+    CHECK(bhttp_req_param_count(&req) == 302);
+    CHECK(param_is(bhttp_req_param_get(&req, "b"), "2"));
+    CHECK(bhttp_req_param_get(&req, "c") == NULL);
+
+    int count = 0;
+    const bhttp_req_param *last = NULL;
+    for (const bhttp_req_param *p = bhttp_req_param_get(&req, "a"); p; p = bhttp_req_param_next(&req, p))
+    {
+        last = p;
+        count++;
+    }
+    CHECK(count == 301);
+    CHECK(param_is(last, "3"));
+    request_done(&req, &rb);
+    bstr_free_contents(&head);
+}
+
+static void
+test_params_repeated(void)
+/* one name sent many times, chained in order */
+{
+    bstr head;
+    bstr_init(&head);
+    bstr_append_cstring_nolen(&head, "GET /q?");
+    for (int i = 0; i < 10000; i++)
+        bstr_append_printf(&head, "a=%d&", i % 10);
+    bstr_append_cstring_nolen(&head, " HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    bhttp_request req;
+    bhttp_readbuf rb;
+    CHECK(parse(&req, &rb, &head) == 0);
+    int count = 0, ordered = 1;
+    for (const bhttp_req_param *p = bhttp_req_param_get(&req, "a"); p; p = bhttp_req_param_next(&req, p))
+    {
+        char want[2] = { (char)('0' + count % 10), 0 };
+        ordered &= param_is(p, want);
+        count++;
+    }
+    CHECK(count == 10000);
+    CHECK(ordered);
+    request_done(&req, &rb);
+    bstr_free_contents(&head);
+}
+
+static void
+test_params_past_table(void)
+/* more distinct names than are hashed, the rest are found in order */
+{
+    bstr head;
+    bstr_init(&head);
+    bstr_append_cstring_nolen(&head, "GET /q?");
+    for (int i = 0; i < BHTTP_PARAM_SLOTS * 2; i++)
+        bstr_append_printf(&head, "n%d=%d&", i, i);
+    bstr_append_printf(&head, "n%d=again HTTP/1.1\r\nHost: x\r\n\r\n", BHTTP_PARAM_SLOTS * 2 - 1);
+
+    bhttp_request req;
+    bhttp_readbuf rb;
+    CHECK(parse(&req, &rb, &head) == 0);
+    char name[16], value[16];
+    int found = 1;
+    for (int i = 0; i < BHTTP_PARAM_SLOTS * 2; i++)
+    {
+        snprintf(name, sizeof name, "n%d", i);
+        snprintf(value, sizeof value, "%d", i);
+        found &= param_is(bhttp_req_param_get(&req, name), value);
+    }
+    CHECK(found);
+    snprintf(name, sizeof name, "n%d", BHTTP_PARAM_SLOTS * 2 - 1);
+    const bhttp_req_param *p = bhttp_req_param_get(&req, name);
+    CHECK(p != NULL && param_is(bhttp_req_param_next(&req, p), "again"));
+    request_done(&req, &rb);
+    bstr_free_contents(&head);
+}
+
+static void
+test_header_folded(void)
+/* obs-fold continuation lines read back joined by single spaces */
+{
+    bstr head;
+    bstr_init(&head);
+    bstr_append_cstring_nolen(&head, "GET / HTTP/1.1\r\nHost: x\r\n"
+                              "X-Folded: a  \r\n \t b\r\n  c\r\nX-Plain: d\r\n\r\n");
+
+    /* also arriving in two reads, split anywhere */
+    size_t len = (size_t)bstr_size(&head);
+    int joined = 1;
+    for (size_t split = 0; split < len; split++)
+    {
+        bhttp_request req;
+        bhttp_readbuf rb;
+        bhttp_readbuf_init(&rb);
+        bhttp_request_init(&req);
+        req.server = server;
+        bhttp_readbuf_append(&rb, bstr_cstring(&head), split);
+        int r = bhttp_request_feed(&req, &rb);
+        bhttp_readbuf_append(&rb, bstr_cstring(&head) + split, len - split);
+        if (r == BHTTP_REQ_OK)
+            r = bhttp_request_feed(&req, &rb);
+        bhttp_header *folded = bhttp_req_get_header(&req, "x-folded");
+        bhttp_header *plain = bhttp_req_get_header(&req, "x-plain");
+        if (r != BHTTP_REQ_OK || !req.done || folded == NULL || plain == NULL ||
+            strcmp(bstr_cstring(&folded->value), "a b c") != 0 ||
+            strcmp(bstr_cstring(&plain->value), "d") != 0)
+        {
+            fprintf(stderr, "split at %zu\n", split);
+            joined = 0;
+        }
+        request_done(&req, &rb);
+    }
+    CHECK(joined);
+    bstr_free_contents(&head);
+}
+
+#define REF_HEADERS 100
+
+/* what http_parser alone makes of a request */
+typedef struct {
+    const char *uri;
+    size_t uri_len;
+    const char *field[REF_HEADERS];
+    size_t field_len[REF_HEADERS];
+    const char *value[REF_HEADERS];
+    size_t value_len[REF_HEADERS];
+    int count;
+    /* a value went on over more than one line */
+    int folded;
+    int method;
+    int keep_alive;
+    int done;
+    int error;
+    size_t used;
+} reference;
+
+static int
+ref_url(http_parser *p, const char *at, size_t len)
+{
+    reference *r = p->data;
+    r->uri = at;
+    r->uri_len = len;
+    return 0;
+}
+
+static int
+ref_field(http_parser *p, const char *at, size_t len)
+{
+    reference *r = p->data;
+    if (r->count < REF_HEADERS)
+    {
+        r->field[r->count] = at;
+        r->field_len[r->count] = len;
+        r->value[r->count] = NULL;
+    }
+    r->count++;
+    return 0;
+}
+
+static int
+ref_value(http_parser *p, const char *at, size_t len)
+{
+    reference *r = p->data;
+    int i = r->count - 1;
+    if (i < REF_HEADERS)
+    {
+        r->folded |= r->value[i] != NULL;
+        r->value[i] = at;
+        r->value_len[i] = len;
+    }
+    return 0;
+}
+
+static int
+ref_complete(http_parser *p)
+{
+    reference *r = p->data;
+    r->done = 1;
+    r->method = (int)p->method;
+    r->keep_alive = http_should_keep_alive(p);
+    http_parser_pause(p, 1);
+    return 0;
+}
+
+static void
+reference_parse(const char *buf, size_t len, reference *r)
+/* runs http_parser over buf up to the end of the first request */
+{
+    static http_parser_settings settings;
+    if (settings.on_url == NULL)
+    {
+        http_parser_settings_init(&settings);
+        settings.on_url = ref_url;
+        settings.on_header_field = ref_field;
+        settings.on_header_value = ref_value;
+        settings.on_message_complete = ref_complete;
+    }
+    memset(r, 0, sizeof *r);
+    http_parser p;
+    http_parser_init(&p, HTTP_REQUEST);
+    p.data = r;
+    r->used = http_parser_execute(&p, &settings, buf, len);
+    r->error = p.http_errno != HPE_OK && p.http_errno != HPE_PAUSED;
+}
+
+static int
+accept_any(bhttp_request *req, bhttp_response *res, bvec *args)
+{
+    (void)req;
+    (void)res;
+    (void)args;
+    return 0;
+}
+
+static int
+same_as_http_parser(const char *buf, size_t len, int whole, int *engine)
+/* parses buf with bhttp_request_feed and with http_parser alone, 1 if they
+ * agree. a cut off head may be refused later than http_parser does it,
+ * never earlier. engine is set to the parser the request ended up with */
+{
+    reference ref;
+    reference_parse(buf, len, &ref);
+
+    bhttp_request req;
+    bhttp_readbuf rb;
+    bhttp_readbuf_init(&rb);
+    bhttp_request_init(&req);
+    req.server = server;
+    bhttp_readbuf_append(&rb, buf, len);
+    int error = bhttp_request_feed(&req, &rb) != BHTTP_REQ_OK;
+    *engine = req.engine;
+
+    int same = 1;
+    if (error ? !ref.error : !ref.error && req.done != ref.done)
+        same = 0;
+    else if (whole && error != ref.error)
+        same = 0;
+    else if (!error && req.done)
+    {
+        int method = ref.method <= HTTP_TRACE ? 1 << ref.method : BHTTP_UNSUPPORTED_METHOD;
+        same = req.method == method &&
+               (size_t)bstr_size(&req.uri) == ref.uri_len &&
+               memcmp(bstr_cstring(&req.uri), ref.uri, ref.uri_len) == 0 &&
+               req.keep_alive == (ref.keep_alive ? BHTTP_KEEP_ALIVE : BHTTP_CLOSE) &&
+               req.header_count == ref.count && ref.count <= REF_HEADERS;
+        /* folded values are joined, see test_header_folded */
+        for (int i = 0; same && !ref.folded && i < req.header_count; i++)
+        {
+            bhttp_req_header *h = &req.headers[i];
+            same = h->field_off == (size_t)(ref.field[i] - buf) && h->field_len == ref.field_len[i] &&
+                   h->value_off == (size_t)(ref.value[i] - buf) && h->value_len == ref.value_len[i];
+        }
+    }
+    request_done(&req, &rb);
+    return same;
+}
+
+static void
+check_head(const char *buf, size_t len, int fast)
+/* buf parses as it does with http_parser alone, and so does every part of
+ * it cut off at the end. in FASTPARSE builds fast says whether fastparse
+ * keeps the request or hands it to http_parser */
+{
+    int engine;
+    if (!same_as_http_parser(buf, len, 1, &engine))
+    {
+        fprintf(stderr, "differs from http_parser: %.*s\n", (int)len, buf);
+        failed = 1;
+    }
+#ifdef FASTPARSE
+    if ((engine != BHTTP_ENGINE_HTTP_PARSER) != fast)
+    {
+        fprintf(stderr, "%s http_parser: %.*s\n", fast ? "fell back to" : "did not fall back to", (int)len, buf);
+        failed = 1;
+    }
+#else
+    (void)fast;
+#endif
+    for (size_t cut = 0; cut < len; cut++)
+    {
+        if (!same_as_http_parser(buf, cut, 0, &engine))
+        {
+            fprintf(stderr, "cut at %zu differs from http_parser: %.*s\n", cut, (int)len, buf);
+            failed = 1;
+        }
+    }
+}
+
+static void
+test_fastparse_corpus(void)
+/* the recorded requests all stay with fastparse */
+{
+    FILE *f = fopen("examples/requests.corpus", "rb");
+    CHECK(f != NULL);
+    if (f == NULL)
+        return;
+    static char corpus[1 << 16];
+    size_t len = fread(corpus, 1, sizeof corpus, f);
+    fclose(f);
+
+    int count = 0;
+    const char *p = corpus;
+    while (len > 0)
+    {
+        reference ref;
+        reference_parse(p, len, &ref);
+        CHECK(ref.done);
+        if (!ref.done)
+            break;
+        check_head(p, ref.used, 1);
+        p += ref.used;
+        len -= ref.used;
+        count++;
+    }
+    CHECK(count == 8);
+}
+
+static void
+test_fastparse_heads(void)
+/* heads fastparse takes, ones it leaves to http_parser and broken ones */
+{
+    static const struct {
+        const char *head;
+        int fast;
+    } heads[] = {
+        {"GET / HTTP/1.1\r\nHost: x\r\n\r\n", 1},
+        {"\r\nGET / HTTP/1.0\nHost: x\nConnection: keep-alive\n\n", 1},
+        {"DELETE /a/very/long/path/that/crosses/several/blocks/of/thirty/two/bytes?x=1&y=2 HTTP/1.1\r\n"
+         "X-A-Header-Name-Longer-Than-32-Bytes|~!#$%&'*+-.^_`: a value\twith a tab and \x80\xff bytes past 32\r\n"
+         "Connection: upgrade, close\r\n\r\n", 1},
+        {"POST /p HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", 1},
+        {"OPTIONS * HTTP/1.1\r\nConnection: Keep-Alive\r\n\r\n", 1},
+        /* valid, but left to http_parser */
+        {"PATCH / HTTP/1.1\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nX-Folded: a\r\n b\r\n\r\n", 0},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: upgrade\r\n\r\n", 0},
+        {"POST / HTTP/1.1\r\nContent-Length: +5\r\n\r\nhello", 0},
+        /* broken */
+        {"GET /a\001b HTTP/1.1\r\n\r\n", 0},
+        {"GET /a\177b HTTP/1.1\r\n\r\n", 0},
+        {"GET / HTTP/2.0\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nBad Name: x\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nX-\"Quoted\": x\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nX-Name-Long-Enough-For-A-Block{}: x\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nNo-Colon\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nX: a\177b\r\n\r\n", 0},
+        {"GET / HTTP/1.1\rX: 1\r\n\r\n", 0},
+        {"GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\nab", 0},
+    };
+    for (size_t i = 0; i < sizeof heads / sizeof heads[0]; i++)
+        check_head(heads[i].head, strlen(heads[i].head), heads[i].fast);
+
+    /* more headers than fastparse takes */
+    bstr head;
+    bstr_init(&head);
+    bstr_append_cstring_nolen(&head, "GET / HTTP/1.1\r\n");
+    for (int i = 0; i < 80; i++)
+        bstr_append_printf(&head, "X-%d: %d\r\n", i, i);
+    bstr_append_cstring_nolen(&head, "\r\n");
+    check_head(bstr_cstring(&head), (size_t)bstr_size(&head), 0);
+    bstr_free_contents(&head);
+}
+
+static void
+test_fastparse_token_ends(void)
+/* | and ~ stop the sse4.2 name scan early, the name still goes on after them */
+{
+    char buf[256];
+    for (int at = 0; at < 40; at++)
+    {
+        for (const char *c = "|~\""; *c; c++)
+        {
+            int n = snprintf(buf, sizeof buf, "GET / HTTP/1.1\r\n%.*s%cTail-Of-The-Name: v\r\n\r\n",
+                             at, "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX", *c);
+            bhttp_fast_header fh[4];
+            bhttp_fast_head head;
+            head.headers = fh;
+            head.num_headers = 4;
+            int r = bhttp_fast_parse_head(buf, (size_t)n, &head);
+            if (*c == '"' ? r != BHTTP_FAST_INVALID :
+                r != n || head.num_headers != 1 || fh[0].name_len != (size_t)at + 17)
+            {
+                fprintf(stderr, "%s: name with %c at %d\n", bhttp_fast_parse_engine(), *c, at);
+                failed = 1;
+            }
+        }
+    }
+}
+
+/* what the multipart callbacks saw, as [name|filename:data] per part */
+static bstr parts_seen;
+
+static int
+part_begin(bhttp_request *req, bhttp_part *part, void *arg)
+{
+    (void)req;
+    (void)arg;
+    bstr_append_printf(&parts_seen, "[%s|%s:", bstr_cstring(&part->name), bstr_cstring(&part->filename));
+    return 0;
+}
+
+static int
+part_data(bhttp_request *req, bhttp_part *part, const char *data, size_t len, void *arg)
+{
+    (void)req;
+    (void)part;
+    (void)arg;
+    bstr_append_cstring(&parts_seen, data, len);
+    return 0;
+}
+
+static int
+part_end(bhttp_request *req, bhttp_part *part, void *arg)
+{
+    (void)req;
+    (void)part;
+    (void)arg;
+    bstr_append_char(&parts_seen, ']');
+    return 0;
+}
+
+static int
+feed_body(const char *uri, const char *body, size_t len, size_t split, size_t step)
+/* posts body to uri as multipart, the first split bytes in one read and the
+ * rest step bytes at a time. returns the code it was refused with, 0 if it
+ * was read to the end and -1 if it was not */
+{
+    bstr head;
+    bstr_init(&head);
+    bstr_append_printf(&head, "POST %s HTTP/1.1\r\nHost: x\r\n"
+                       "Content-Type: multipart/form-data; boundary=\"XyZ\"\r\n"
+                       "Content-Length: %zu\r\n\r\n", uri, len);
+    bhttp_request req;
+    bhttp_readbuf rb;
+    bhttp_readbuf_init(&rb);
+    bhttp_request_init(&req);
+    req.server = server;
+    bhttp_readbuf_append(&rb, bstr_cstring(&head), (size_t)bstr_size(&head));
+    bstr_free_contents(&head);
+
+    int r = bhttp_request_feed(&req, &rb);
+    for (size_t off = 0; r == BHTTP_REQ_OK && !req.done && off < len; )
+    {
+        size_t n = off < split ? split - off : step;
+        if (n > len - off)
+            n = len - off;
+        bhttp_readbuf_append(&rb, body + off, n);
+        r = bhttp_request_feed(&req, &rb);
+        off += n;
+    }
+    int code = r != BHTTP_REQ_OK || !req.done ? -1 : req.reject;
+    request_done(&req, &rb);
+    return code;
+}
+
+static void
+test_multipart_split(void)
+/* the same parts come out wherever the body is cut */
+{
+    static const char body[] =
+        "preamble\r\n--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"a\"\r\n\r\n"
+        "one\r\n--Xy!\r\n-\r\n--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"f\"; filename=\"f.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n"
+        "\r\n--\0two\r\r\n--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"empty\"\r\n\r\n"
+        "\r\n--XyZ--\r\nepilogue";
+    static const char want[] = "[a|:one\r\n--Xy!\r\n-][f|f.bin:\r\n--\0two\r][empty|:]";
+    size_t len = sizeof body - 1;
+    size_t open_len = len - strlen("\r\n--XyZ--\r\nepilogue");
+    /* the rest of the body in one piece, or a byte at a time */
+    size_t steps[2] = { len, 1 };
+    int same = 1;
+    for (size_t split = 0; split <= len; split++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            size_t step = steps[i];
+            bstr_free_contents(&parts_seen);
+            bstr_init(&parts_seen);
+            int code = feed_body("/form", body, len, split, step);
+            if (code != 0 || (size_t)bstr_size(&parts_seen) != sizeof want - 1 ||
+                memcmp(bstr_cstring(&parts_seen), want, sizeof want - 1) != 0)
+            {
+                fprintf(stderr, "multipart split at %zu, then %zu at a time: %d\n", split, step, code);
+                same = 0;
+            }
+
+            /* without the closing delimiter */
+            bstr_free_contents(&parts_seen);
+            bstr_init(&parts_seen);
+            if (split <= open_len && (code = feed_body("/form", body, open_len, split, step)) != BHTTP_400)
+            {
+                fprintf(stderr, "unclosed multipart split at %zu, then %zu at a time: %d\n", split, step, code);
+                same = 0;
+            }
+
+            /* part "f" has 9 bytes, one more than allowed */
+            if ((code = feed_body("/form-small", body, len, split, step)) != BHTTP_413)
+            {
+                fprintf(stderr, "large part split at %zu, then %zu at a time: %d\n", split, step, code);
+                same = 0;
+            }
+        }
+    }
+    CHECK(same);
+    bstr_free_contents(&parts_seen);
+}
+
+static long
+url_decode_scalar(const char *src, size_t len, char *dest)
+/* bhttp_url_decode a byte at a time, as urldecode.h describes it */
+{
+    long n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (src[i] == '\0')
+            return -1;
+        if (src[i] != '%')
+        {
+            dest[n++] = src[i] == '+' ? ' ' : src[i];
+            continue;
+        }
+        if (len - i < 3 || !isxdigit((unsigned char)src[i+1]) || !isxdigit((unsigned char)src[i+2]))
+            return -1;
+        char hex[3] = { src[i+1], src[i+2], 0 };
+        if ((dest[n++] = (char)strtol(hex, NULL, 16)) == '\0')
+            return -1;
+        i += 2;
+    }
+    return n;
+}
+
+static int
+same_decode(const char *src, size_t len)
+/* 1 if bhttp_url_decode agrees with url_decode_scalar and stays inside dest */
+{
+    char want[128], got[128 + 32];
+    memset(got, 0x55, sizeof got);
+    long n = url_decode_scalar(src, len, want);
+    long r = bhttp_url_decode(src, len, got);
+    for (size_t i = len; i < sizeof got; i++)
+    {
+        if (got[i] != 0x55)
+            return 0;
+    }
+    return r == n && (n < 0 || memcmp(got, want, (size_t)n) == 0);
+}
+
+static void
+test_url_decode(void)
+/* every length that reaches the 16 and 32 byte block paths, with each kind
+ * of escape at every position, then random mixes */
+{
+    static const char *inserts[] = { "+", "%41", "%4a%E9", "%00", "%", "%4", "%g1", "%+1", "++%2B+" };
+    char buf[80];
+    int same = 1;
+    for (size_t len = 0; len <= 70; len++)
+    {
+        for (size_t k = 0; k < sizeof inserts / sizeof inserts[0]; k++)
+        {
+            for (size_t at = 0; at <= len; at++)
+            {
+                for (size_t i = 0; i < len; i++)
+                    buf[i] = (char)('a' + i % 26);
+                size_t n = strlen(inserts[k]);
+                memcpy(buf + at, inserts[k], at + n > len ? len - at : n);
+                if (!same_decode(buf, len))
+                {
+                    fprintf(stderr, "url decode of %zu bytes with %s at %zu\n", len, inserts[k], at);
+                    same = 0;
+                }
+            }
+        }
+        /* a raw NUL anywhere */
+        for (size_t at = 0; at < len; at++)
+        {
+            memset(buf, 'a', len);
+            buf[at] = '\0';
+            if (!same_decode(buf, len))
+            {
+                fprintf(stderr, "url decode of %zu bytes with NUL at %zu\n", len, at);
+                same = 0;
+            }
+        }
+    }
+
+    static const char alphabet[] = "ab+%%0aF9g\xff";
+    unsigned seed = 1;
+    for (int round = 0; round < 20000; round++)
+    {
+        size_t len = (size_t)round % 71;
+        for (size_t i = 0; i < len; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            buf[i] = alphabet[(seed >> 16) % (sizeof alphabet - 1)];
+        }
+        if (!same_decode(buf, len))
+        {
+            fprintf(stderr, "url decode of \"%.*s\"\n", (int)len, buf);
+            same = 0;
+        }
+    }
+    CHECK(same);
+}
+
+static void
+test_known_headers(void)
+/* every known name finds itself in the perfect hash in any case, so no two
+ * share a slot, and near misses find nothing */
+{
+#define K(k, v) { k, v },
+    static const struct {
+        int header;
+        const char *name;
+    } known[] = { BHTTP_KNOWN_HEADERS };
+#undef K
+    CHECK(sizeof known / sizeof known[0] == BHTTP_H_COUNT);
+    char buf[64];
+    for (size_t i = 0; i < sizeof known / sizeof known[0]; i++)
+    {
+        size_t len = strlen(known[i].name);
+        int found = bhttp_header_known(known[i].name, len) == known[i].header;
+        for (size_t j = 0; j < len; j++)
+            buf[j] = (char)toupper((unsigned char)known[i].name[j]);
+        found &= bhttp_header_known(buf, len) == known[i].header;
+        for (size_t j = 0; j < len; j++)
+            buf[j] = j % 2 ? buf[j] : known[i].name[j];
+        found &= bhttp_header_known(buf, len) == known[i].header;
+
+        memcpy(buf, known[i].name, len);
+        buf[len] = 's';
+        found &= bhttp_header_known(buf, len + 1) == BHTTP_H_UNKNOWN;
+        found &= bhttp_header_known(buf, len - 1) == BHTTP_H_UNKNOWN;
+        buf[len / 2] ^= 1;
+        found &= bhttp_header_known(buf, len) == BHTTP_H_UNKNOWN;
+        if (!found)
+        {
+            fprintf(stderr, "known header %s\n", known[i].name);
+            failed = 1;
+        }
+    }
+}
+
+static void
+test_arena_ownership(void)
+/* memory goes back where it came from whichever arena is in use */
+{
+    bhttp_arena a, b;
+    bhttp_arena_init(&a, 1024, NULL);
+    bhttp_arena_init(&b, 1024, NULL);
+
+    bhttp_arena *prev = bhttp_arena_use(&a);
+    char *small = bhttp_malloc(100);
+    char *large = bhttp_malloc(4000);
+    char *last = bhttp_malloc(10);
+    bhttp_arena_use(NULL);
+    char *heap = bhttp_malloc(10);
+    CHECK(small != NULL && large != NULL && last != NULL && heap != NULL);
+    memset(small, 's', 100);
+    memset(large, 'l', 4000);
+    memcpy(last, "012345678", 10);
+
+    /* arena memory freed under another arena or none is not free()d */
+    bhttp_arena_use(&b);
+    bhttp_free(small);
+    bhttp_free(large);
+    CHECK(a.large == NULL);
+    bhttp_free(heap);
+
+    /* grown outside its arena, it moves to the one in use with its bytes */
+    bhttp_arena_use(NULL);
+    char *moved = bhttp_realloc(last, 2000);
+    CHECK(moved != NULL && moved != last && memcmp(moved, "012345678", 10) == 0);
+    bhttp_free(moved);
+
+    /* the latest allocation still grows in place under its own arena */
+    bhttp_arena_use(&a);
+    char *grow = bhttp_malloc(8);
+    CHECK(grow != NULL && bhttp_realloc(grow, 64) == grow);
+    bhttp_free(grow);
+
+    bhttp_arena_use(prev);
+    bhttp_arena_free(&a);
+    bhttp_arena_free(&b);
+}
+
+int
+main(void)
+{
+    server = bhttp_server_new();
+    if (server == NULL)
+        return 1;
+    /* the long queries here are over the default uri limit */
+    bhttp_limits limits = {0};
+    bhttp_server_set_limits(server, &limits);
+    bhttp_body_opts form = {0};
+    form.multipart.on_part = part_begin;
+    form.multipart.on_data = part_data;
+    form.multipart.on_part_end = part_end;
+    bhttp_add_regex_handler(server, BHTTP_POST, "^/form$", accept_any);
+    bhttp_handler_set_body_opts(server, "^/form$", &form);
+    form.multipart.max_part_size = 8;
+    bhttp_add_regex_handler(server, BHTTP_POST, "^/form-small$", accept_any);
+    bhttp_handler_set_body_opts(server, "^/form-small$", &form);
+    /* so bodies are read rather than refused */
+    bhttp_add_regex_handler(server, BHTTP_POST | BHTTP_PUT | BHTTP_DELETE, "^/", accept_any);
+
+    test_params_after_many();
+    test_params_repeated();
+    test_params_past_table();
+    test_header_folded();
+    test_fastparse_corpus();
+    test_fastparse_heads();
+    test_fastparse_token_ends();
+    test_multipart_split();
+    test_url_decode();
+    test_known_headers();
+    test_arena_ownership();
+
+    bhttp_server_free(server);
+    if (!failed)
+        printf("request_test: ok, fastparse %s, url decoding %s\n",
+               bhttp_fast_parse_engine(), bhttp_url_decode_engine());
+    return failed;
+}